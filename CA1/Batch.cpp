@@ -0,0 +1,184 @@
+#include "Batch.h"
+#include "Loader.h"
+
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+using namespace std;
+
+struct BatchTask {
+	string path;
+	bool hasExpected;
+	int expected[2];
+	// filled in by the worker
+	enum { PENDING, PASS, FAIL, RUN, ERROR, HUNG } status;
+	uint64_t instret;
+	int result[2];
+};
+
+// one deque per worker: the owner pops from the back, idle workers steal from the front
+struct WorkQueue {
+	mutex lock;
+	deque<size_t> tasks;
+};
+
+static bool readManifest(const string& manifest, vector<BatchTask>& tasks)
+{
+	ifstream in(manifest.c_str());
+	if (!in){
+		return false;
+	}
+	string dir;
+	size_t slash = manifest.find_last_of('/');
+	if (slash != string::npos){
+		dir = manifest.substr(0, slash + 1);
+	}
+
+	string line;
+	while (getline(in, line)){
+		// "(a0,a1)" reads the same as "a0 a1"
+		for (size_t i = 0; i < line.size(); i++){
+			if (line[i] == '(' || line[i] == ')' || line[i] == ',' || line[i] == '\r') line[i] = ' ';
+		}
+		istringstream fields(line);
+		BatchTask t = BatchTask();
+		if (!(fields >> t.path) || t.path[0] == '#'){
+			continue;
+		}
+		if (t.path[0] != '/'){
+			t.path = dir + t.path;
+		}
+		t.hasExpected = (bool)(fields >> t.expected[0] >> t.expected[1]);
+		tasks.push_back(t);
+	}
+	return true;
+}
+
+static void runTask(BatchTask& t, Engine engine, uint64_t limit)
+{
+	vector<uint32_t> words;
+	if (!loadImage(t.path.c_str(), words)){
+		t.status = BatchTask::ERROR;
+		return;
+	}
+	CPU cpu;
+	cpu.predecode(words);
+	cpu.run(engine, false, limit);
+	t.instret = cpu.instret;
+	t.result[0] = cpu.regfile[10];
+	t.result[1] = cpu.regfile[11];
+	if (!cpu.halted()){
+		t.status = BatchTask::HUNG;
+	}
+	else if (!t.hasExpected){
+		t.status = BatchTask::RUN;
+	}
+	else{
+		t.status = (t.result[0] == t.expected[0] && t.result[1] == t.expected[1]) ? BatchTask::PASS : BatchTask::FAIL;
+	}
+}
+
+static void worker(unsigned self, vector<WorkQueue>& queues, vector<BatchTask>& tasks, Engine engine, uint64_t limit)
+{
+	unsigned nq = queues.size();
+	for (;;){
+		size_t task = 0;
+		bool found = false;
+		{
+			WorkQueue& q = queues[self];
+			lock_guard<mutex> g(q.lock);
+			if (!q.tasks.empty()){
+				task = q.tasks.back();
+				q.tasks.pop_back();
+				found = true;
+			}
+		}
+		// own queue is empty: steal the oldest task from the next worker that has one
+		for (unsigned k = 1; !found && k < nq; k++){
+			WorkQueue& q = queues[(self + k) % nq];
+			lock_guard<mutex> g(q.lock);
+			if (!q.tasks.empty()){
+				task = q.tasks.front();
+				q.tasks.pop_front();
+				found = true;
+			}
+		}
+		// nothing left anywhere (tasks never spawn new tasks, so this is final)
+		if (!found){
+			return;
+		}
+		runTask(tasks[task], engine, limit);
+	}
+}
+
+int runBatch(const string& manifest, Engine engine, unsigned threads, uint64_t limit, const string& reportPath)
+{
+	vector<BatchTask> tasks;
+	if (!readManifest(manifest, tasks)){
+		cerr << "can't open manifest " << manifest << "\n";
+		return -1;
+	}
+
+	ofstream file;
+	if (!reportPath.empty()){
+		file.open(reportPath.c_str());
+		if (!file){
+			cerr << "can't open report " << reportPath << "\n";
+			return -1;
+		}
+	}
+	ostream& report = reportPath.empty() ? cout : file;
+
+	if (threads == 0){
+		threads = thread::hardware_concurrency();
+	}
+	if (threads == 0){
+		threads = 1;
+	}
+	if (threads > tasks.size()){
+		threads = tasks.size() ? tasks.size() : 1;
+	}
+
+	// deal the tasks out round-robin; stealing evens out whatever the deal got wrong
+	vector<WorkQueue> queues(threads);
+	for (size_t i = 0; i < tasks.size(); i++){
+		queues[i % threads].tasks.push_back(i);
+	}
+
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	vector<thread> pool;
+	for (unsigned w = 1; w < threads; w++){
+		pool.push_back(thread(worker, w, ref(queues), ref(tasks), engine, limit));
+	}
+	worker(0, queues, tasks, engine, limit);
+	for (size_t w = 0; w < pool.size(); w++){
+		pool[w].join();
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+	static const char* const names[] = { "PENDING", "PASS", "FAIL", "RUN", "ERROR", "HUNG" };
+	unsigned counts[6] = { 0, 0, 0, 0, 0, 0 };
+	uint64_t total = 0;
+	for (size_t i = 0; i < tasks.size(); i++){
+		const BatchTask& t = tasks[i];
+		counts[t.status]++;
+		total += t.instret;
+		report << names[t.status] << " " << t.instret;
+		if (t.status != BatchTask::ERROR){
+			report << " (" << t.result[0] << "," << t.result[1] << ")";
+		}
+		if (t.hasExpected){
+			report << " expected (" << t.expected[0] << "," << t.expected[1] << ")";
+		}
+		report << " " << t.path << "\n";
+	}
+	report << "# " << tasks.size() << " programs: " << counts[BatchTask::PASS] << " pass, "
+		<< counts[BatchTask::FAIL] << " fail, " << counts[BatchTask::RUN] << " run, "
+		<< counts[BatchTask::ERROR] << " error, " << counts[BatchTask::HUNG] << " hung; " << total << " instructions in " << seconds
+		<< " s on " << threads << " threads\n";
+	return counts[BatchTask::FAIL] + counts[BatchTask::ERROR] + counts[BatchTask::HUNG];
+}
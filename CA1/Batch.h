@@ -0,0 +1,23 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "CPU.h"
+
+#include <string>
+using namespace std;
+
+/*
+Batch mode: run every program listed in a manifest in-process on a pool of worker threads.
+Manifest lines are "<program> [a0 a1]" (the expected pair may also be written "(a0,a1)"); blank lines
+and lines starting with # are skipped, and relative program paths are taken from the manifest's
+directory. Each program gets its own CPU and runs on the chosen engine for at most limit
+instructions. The report has one line per program, in manifest order:
+	PASS|FAIL|RUN|ERROR|HUNG <instructions> (a0,a1) [expected] <program>
+(RUN = no expected values given, ERROR = couldn't load the file, HUNG = still running after limit
+instructions) followed by a summary line. threads = 0 uses one worker per hardware thread. Returns
+the number of FAIL/ERROR/HUNG entries, or -1 if the manifest or report can't be opened.
+*/
+const uint64_t BATCH_DEFAULT_LIMIT = 1000000000;
+int runBatch(const string& manifest, Engine engine, unsigned threads, uint64_t limit, const string& reportPath);
+
+#endif /* BATCH_H */
@@ -0,0 +1,422 @@
+#include "CPU.h"
+#include "Loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+/*
+Benchmarks for the simulator itself: how long each piece of the hot path takes on its own
+(fetchInstruction, decode, ALU::executeALU, the load/store helpers) and how fast the engines run a
+few bundled loops end to end. Everything is reported as JSON so runs can be compared over time.
+
+	cpusim-bench [-o file] [--reps n] [--min-ms n] [--scale n] [program ...]
+
+Each measurement is taken reps times (default 5) and the best and median are reported. The
+micro benchmarks repeat their loop until one rep takes at least min-ms (default 100). --scale
+multiplies the loop counts of the bundled programs; extra program files are run on every engine too.
+*/
+
+static volatile uint32_t sink; // keeps the optimizer from dropping the measured work
+
+// a tiny assembler for the bundled loops, labels resolved at the end
+class Asm {
+public:
+	vector<uint32_t> words;
+
+	void r(int f7, int rs2, int rs1, int f3, int rd) { emit(f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | 0x33); }
+	void i(int imm, int rs1, int f3, int rd, int opcode = 0x13) { emit((imm & 0xFFF) << 20 | rs1 << 15 | f3 << 12 | rd << 7 | opcode); }
+	void s(int imm, int rs2, int rs1, int f3) { emit((imm >> 5 & 0x7F) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | (imm & 31) << 7 | 0x23); }
+	void lui(int rd, uint32_t imm20) { emit(imm20 << 12 | rd << 7 | 0x37); }
+	void li(int rd, uint32_t value) { lui(rd, (value + 0x800) >> 12); i(value & 0xFFF, rd, 0, rd); }
+	void lw(int rd, int imm, int rs1) { i(imm, rs1, 2, rd, 0x03); }
+	void sw(int rs2, int imm, int rs1) { s(imm, rs2, rs1, 2); }
+	void branch(int f3, int rs1, int rs2, const string& target) { fixups.push_back(Fixup{words.size(), target, f3, rs1, rs2, false}); emit(0); }
+	void j(const string& target) { fixups.push_back(Fixup{words.size(), target, 0, 0, 0, true}); emit(0); }
+	void label(const string& name) { labels.push_back(make_pair(name, words.size())); }
+
+	vector<uint32_t> finish()
+	{
+		for (size_t f = 0; f < fixups.size(); f++){
+			const Fixup& x = fixups[f];
+			int32_t offset = 4 * ((int32_t)find(x.target) - (int32_t)x.at);
+			uint32_t o = offset;
+			if (x.jump){
+				words[x.at] = (o >> 20 & 1) << 31 | (o >> 1 & 0x3FF) << 21 | (o >> 11 & 1) << 20 | (o & 0xFF000) | 0x6F;
+			}
+			else{
+				words[x.at] = (o >> 12 & 1) << 31 | (o >> 5 & 0x3F) << 25 | x.rs2 << 20 | x.rs1 << 15 | x.f3 << 12
+					| (o >> 1 & 0xF) << 8 | (o >> 11 & 1) << 7 | 0x63;
+			}
+		}
+		return words;
+	}
+
+private:
+	struct Fixup { size_t at; string target; int f3, rs1, rs2; bool jump; };
+	vector<Fixup> fixups;
+	vector<pair<string, size_t> > labels;
+
+	void emit(uint32_t word) { words.push_back(word); }
+	size_t find(const string& name) const
+	{
+		for (size_t l = 0; l < labels.size(); l++){
+			if (labels[l].first == name) return labels[l].second;
+		}
+		cerr << "bench: no label " << name << "\n";
+		exit(1);
+	}
+};
+
+enum { BEQ = 0, BNE = 1, BLT = 4, BGE = 5, BLTU = 6, BGEU = 7 };
+
+// tight ALU loop, ten instructions an iteration
+static vector<uint32_t> aluLoop(uint32_t iterations)
+{
+	Asm a;
+	a.li(5, iterations);
+	a.li(6, 0x12345);
+	a.label("loop");
+	a.r(0, 6, 10, 0, 10);    // add x10, x10, x6
+	a.r(0, 10, 11, 4, 11);   // xor x11, x11, x10
+	a.i(3, 10, 1, 7);        // slli x7, x10, 3
+	a.r(0x20, 7, 11, 0, 11); // sub x11, x11, x7
+	a.i(7, 6, 0, 6);         // addi x6, x6, 7
+	a.r(0, 11, 12, 6, 12);   // or x12, x12, x11
+	a.r(0, 11, 10, 3, 13);   // sltu x13, x10, x11
+	a.r(0, 13, 10, 0, 10);   // add x10, x10, x13
+	a.i(-1, 5, 0, 5);        // addi x5, x5, -1
+	a.branch(BNE, 5, 0, "loop");
+	return a.finish();
+}
+
+// fill 4 KB, then copy it to another page over and over, two words an iteration
+static vector<uint32_t> copyLoop(uint32_t passes)
+{
+	Asm a;
+	a.lui(5, 0x10);          // src 0x10000
+	a.lui(8, 0x11);
+	a.label("fill");
+	a.sw(5, 0, 5);
+	a.i(4, 5, 0, 5);
+	a.branch(BNE, 5, 8, "fill");
+	a.li(9, passes);
+	a.label("pass");
+	a.lui(5, 0x10);
+	a.lui(6, 0x20);          // dst 0x20000
+	a.label("copy");
+	a.lw(7, 0, 5);
+	a.lw(12, 4, 5);
+	a.sw(7, 0, 6);
+	a.sw(12, 4, 6);
+	a.i(8, 5, 0, 5);
+	a.i(8, 6, 0, 6);
+	a.branch(BNE, 5, 8, "copy");
+	a.r(0, 7, 10, 0, 10);    // add x10, x10, x7
+	a.i(-1, 9, 0, 9);
+	a.branch(BNE, 9, 0, "pass");
+	return a.finish();
+}
+
+// binary search of pseudo-random keys in a sorted table: data-dependent branches and loads
+static vector<uint32_t> searchLoop(uint32_t searches)
+{
+	Asm a;
+	a.lui(20, 0x10);         // table base: a[i] = 2i, 1024 entries
+	a.i(0, 20, 0, 5);
+	a.i(0, 0, 0, 6);
+	a.li(8, 2048);
+	a.label("init");
+	a.sw(6, 0, 5);
+	a.i(4, 5, 0, 5);
+	a.i(2, 6, 0, 6);
+	a.branch(BNE, 6, 8, "init");
+	a.li(9, searches);
+	a.li(7, 2463534242u);
+	a.label("search");
+	a.i(13, 7, 1, 12);       // xorshift32 x7
+	a.r(0, 12, 7, 4, 7);
+	a.i(17, 7, 5, 12);
+	a.r(0, 12, 7, 4, 7);
+	a.i(5, 7, 1, 12);
+	a.r(0, 12, 7, 4, 7);
+	a.i(2047, 7, 7, 13);     // key = x7 & 2047
+	a.i(0, 0, 0, 14);        // lo
+	a.i(1024, 0, 0, 15);     // hi
+	a.label("probe");
+	a.branch(BGEU, 14, 15, "done");
+	a.r(0, 15, 14, 0, 16);   // mid = (lo + hi) >> 1
+	a.i(1, 16, 5, 16);
+	a.i(2, 16, 1, 17);
+	a.r(0, 20, 17, 0, 17);
+	a.lw(18, 0, 17);
+	a.branch(BGEU, 18, 13, "right");
+	a.i(1, 16, 0, 14);       // a[mid] < key: lo = mid + 1
+	a.j("probe");
+	a.label("right");
+	a.i(0, 16, 0, 15);       // hi = mid
+	a.j("probe");
+	a.label("done");
+	a.i(2, 14, 1, 17);
+	a.r(0, 20, 17, 0, 17);
+	a.lw(18, 0, 17);
+	a.branch(BNE, 18, 13, "miss");
+	a.i(1, 10, 0, 10);       // found: a0++
+	a.label("miss");
+	a.i(-1, 9, 0, 9);
+	a.branch(BNE, 9, 0, "search");
+	return a.finish();
+}
+
+// a bundled loop's count at the given scale; the counter is a 32-bit guest register
+static uint32_t loopCount(uint64_t base, int scale)
+{
+	return (uint32_t)min<uint64_t>(base * scale, UINT32_MAX);
+}
+
+typedef chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point start)
+{
+	return chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Stats {
+	double best, median;
+};
+
+static Stats summarize(vector<double> times)
+{
+	sort(times.begin(), times.end());
+	Stats s = { times[0], times[times.size() / 2] };
+	return s;
+}
+
+// time body(n) reps times, n grown until one rep takes minSeconds; returns seconds per op
+template <class F> static Stats timeMicro(F body, unsigned reps, double minSeconds, uint64_t& n)
+{
+	n = 1 << 12;
+	for (;;){
+		Clock::time_point start = Clock::now();
+		body(n);
+		double t = seconds(start);
+		if (t >= minSeconds || n >= (1ull << 40)) break;
+		n = (t > minSeconds / 100) ? (uint64_t)(n * minSeconds / t * 1.1) : n * 10;
+	}
+	vector<double> times;
+	for (unsigned r = 0; r < reps; r++){
+		Clock::time_point start = Clock::now();
+		body(n);
+		times.push_back(seconds(start) / n);
+	}
+	return summarize(times);
+}
+
+static void jsonMicro(ostream& out, bool& first, const string& name, uint64_t ops, Stats s)
+{
+	out << (first ? "" : ",\n") << "    {\"name\": \"" << name << "\", \"ops\": " << ops
+		<< ", \"ns_per_op\": " << s.best * 1e9 << ", \"median_ns_per_op\": " << s.median * 1e9
+		<< ", \"mops\": " << 1e-6 / s.best << "}";
+	first = false;
+}
+
+static string jsonString(const string& s)
+{
+	string r;
+	for (size_t i = 0; i < s.size(); i++){
+		if (s[i] == '"' || s[i] == '\\') r += '\\';
+		r += s[i];
+	}
+	return r;
+}
+
+static void runMicro(ostream& out, const vector<uint32_t>& code, unsigned reps, double minSeconds)
+{
+	CPU cpu;
+	cpu.predecode(code);
+	uint64_t n;
+	bool first = true;
+	out << "  \"micro\": [\n";
+
+	// fetch: walk PC over the image
+	size_t words = code.size();
+	Stats s = timeMicro([&](uint64_t n) {
+		uint32_t acc = 0;
+		size_t pc = 0;
+		for (uint64_t k = 0; k < n; k++){
+			cpu.setPC(pc);
+			acc ^= cpu.fetchInstruction().instr;
+			if (++pc == words) pc = 0;
+		}
+		sink = acc;
+	}, reps, minSeconds, n);
+	jsonMicro(out, first, "fetchInstruction", n, s);
+
+	// decode: every word of every bundled loop, in turn
+	vector<uint32_t> mix = code;
+	vector<uint32_t> more = copyLoop(1), search = searchLoop(1);
+	mix.insert(mix.end(), more.begin(), more.end());
+	mix.insert(mix.end(), search.begin(), search.end());
+	s = timeMicro([&](uint64_t n) {
+		uint32_t acc = 0;
+		size_t w = 0;
+		for (uint64_t k = 0; k < n; k++){
+			DecodedOp op = cpu.decode(mix[w]);
+			acc += op.opclass ^ op.imm ^ op.rd;
+			if (++w == mix.size()) w = 0;
+		}
+		sink = acc;
+	}, reps, minSeconds, n);
+	jsonMicro(out, first, "decode", n, s);
+
+	// executeALU: all ten ops round robin on varying operands
+	s = timeMicro([&](uint64_t n) {
+		uint32_t x = 2463534242u, acc = 0;
+		int aluop = 0;
+		for (uint64_t k = 0; k < n; k++){
+			x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+			cpu.alu.executeALU(aluop, x, x >> 7);
+			acc += cpu.alu.alu_res;
+			if (++aluop == 10) aluop = 0;
+		}
+		sink = acc;
+	}, reps, minSeconds, n);
+	jsonMicro(out, first, "executeALU", n, s);
+
+	// memory helpers on one page (the cached-page fast path) and across 64 pages (the slow path)
+	const uint32_t base = 0x100000;
+	struct Access { const char* name; int kind; uint32_t step, span; };
+	static const Access accesses[] = {
+		{ "loadword", 0, 4, 4096 }, { "storeword", 1, 4, 4096 },
+		{ "loadhalf", 2, 2, 4096 }, { "storehalf", 3, 2, 4096 },
+		{ "loadbyte", 4, 1, 4096 }, { "storebyte", 5, 1, 4096 },
+		{ "loadword/pages", 0, 4096 + 4, 64 * 4096 }, { "storeword/pages", 1, 4096 + 4, 64 * 4096 },
+	};
+	for (size_t a = 0; a < sizeof(accesses) / sizeof(accesses[0]); a++){
+		const Access& m = accesses[a];
+		s = timeMicro([&](uint64_t n) {
+			uint32_t acc = 0, offset = 0;
+			for (uint64_t k = 0; k < n; k++){
+				uint32_t address = base + offset;
+				switch (m.kind){
+					case 0: acc += cpu.loadword(address); break;
+					case 1: cpu.storeword(address, k); break;
+					case 2: acc += cpu.loadhalf(address); break;
+					case 3: cpu.storehalf(address, k); break;
+					case 4: acc += cpu.loadbyte(address); break;
+					default: cpu.storebyte(address, k); break;
+				}
+				offset += m.step;
+				if (offset >= m.span) offset -= m.span;
+			}
+			sink = acc;
+		}, reps, minSeconds, n);
+		jsonMicro(out, first, string("mem/") + m.name, n, s);
+	}
+	out << "\n  ],\n";
+}
+
+struct Program {
+	string name;
+	vector<uint32_t> code;
+};
+
+static void runPrograms(ostream& out, const vector<Program>& programs, unsigned reps)
+{
+	static const char* const engines[] = { "interp", "threaded", "blocks", "jit" };
+	bool first = true;
+	out << "  \"programs\": [\n";
+	for (size_t p = 0; p < programs.size(); p++){
+		string expected;
+		for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++){
+			Engine engine;
+			parseEngine(engines[e], engine);
+			vector<double> times;
+			uint64_t instructions = 0;
+			string result;
+			for (unsigned r = 0; r < reps; r++){
+				CPU cpu;
+				cpu.predecode(programs[p].code);
+				Clock::time_point start = Clock::now();
+				cpu.run(engine, false);
+				times.push_back(seconds(start));
+				instructions = cpu.instret;
+				result = "[" + to_string(cpu.regfile[10]) + ", " + to_string(cpu.regfile[11]) + "]";
+			}
+			if (expected.empty()) expected = result;
+			Stats s = summarize(times);
+			// the rates are null when there's nothing to divide by (JSON has no inf or nan)
+			bool rated = instructions > 0 && s.best > 0;
+			out << (first ? "" : ",\n") << "    {\"name\": \"" << jsonString(programs[p].name) << "\", \"engine\": \""
+				<< engines[e] << "\", \"instructions\": " << instructions << ", \"seconds\": " << s.best
+				<< ", \"median_seconds\": " << s.median << ", \"ns_per_instruction\": ";
+			if (rated) out << s.best * 1e9 / instructions << ", \"mips\": " << instructions / s.best * 1e-6;
+			else out << "null, \"mips\": null";
+			out << ", \"a0a1\": " << result
+				<< ", \"agrees\": " << (result == expected ? "true" : "false") << "}";
+			first = false;
+			if (result != expected){
+				cerr << "bench: " << programs[p].name << " gives " << result << " on " << engines[e]
+					<< " but " << expected << " on interp\n";
+			}
+		}
+	}
+	out << "\n  ]\n";
+}
+
+int main(int argc, char* argv[])
+{
+	string outPath;
+	unsigned reps = 5, minMs = 100;
+	int scale = 1;
+	vector<Program> programs;
+	vector<string> files;
+	for (int a = 1; a < argc; a++){
+		string arg = argv[a];
+		if (arg == "-o" && a + 1 < argc) outPath = argv[++a];
+		else if (arg == "--reps" && a + 1 < argc) reps = max(1, atoi(argv[++a]));
+		else if (arg == "--min-ms" && a + 1 < argc) minMs = max(1, atoi(argv[++a]));
+		else if (arg == "--scale" && a + 1 < argc) scale = max(1, atoi(argv[++a]));
+		else if (arg[0] != '-') files.push_back(arg);
+		else{
+			cerr << "usage: " << argv[0] << " [-o file] [--reps n] [--min-ms n] [--scale n] [program ...]\n";
+			return 1;
+		}
+	}
+
+	// about 20M instructions each at scale 1
+	programs.push_back(Program{ "alu", aluLoop(loopCount(2000000, scale)) });
+	programs.push_back(Program{ "copy", copyLoop(loopCount(5600, scale)) });
+	programs.push_back(Program{ "search", searchLoop(loopCount(200000, scale)) });
+	for (size_t f = 0; f < files.size(); f++){
+		Program p{ files[f], vector<uint32_t>() };
+		if (!loadImage(files[f].c_str(), p.code)){
+			cerr << "can't open " << files[f] << "\n";
+			return 1;
+		}
+		programs.push_back(p);
+	}
+
+	ofstream file;
+	if (!outPath.empty()){
+		file.open(outPath.c_str());
+		if (!file){
+			cerr << "can't write " << outPath << "\n";
+			return 1;
+		}
+	}
+	ostream& out = outPath.empty() ? cout : file;
+	out << "{\n  \"reps\": " << reps << ",\n  \"scale\": " << scale << ",\n";
+#if defined(__VERSION__)
+	out << "  \"compiler\": \"" << jsonString(__VERSION__) << "\",\n";
+#endif
+	runMicro(out, programs[0].code, reps, minMs / 1000.0);
+	runPrograms(out, programs, reps);
+	out << "}\n";
+	return 0;
+}
@@ -0,0 +1,324 @@
+#include "CPU.h"
+
+#include <deque>
+using namespace std;
+
+/*
+Basic-block translation cache.
+Control flow only changes at branches and jumps, so the program splits into straight-line blocks that
+end at the next one. Each block is translated once (keyed by its start PC), common instruction pairs
+are fused into superinstructions, and blocks remember their successors so hot loops go from block
+to block without looking anything up. A store into the instruction image flushes the whole cache.
+With an instruction limit, a block that would run past it is not entered; the rest is single-stepped.
+*/
+
+// block handlers: the threaded kinds plus the fused pairs and an unconditional "next block"
+enum BlockKind {
+	B_LI2 = T_NUMKINDS, // LUI rd + ADDI/ORI rd2, rd: both constants are known at translation time
+	B_ADDI_BNE,         // ADDI rd, rs1 followed by the block-ending BNE rs1b, rs2b
+	B_GOTO,             // block was cut at MAX_BLOCK_OPS, fall through to the next one
+	B_NUMKINDS
+};
+
+struct BlockOp {
+	const void* handler; // address of the handler label (computed goto builds)
+	int32_t imm, imm2;   // B_LI2: both results, branches/JAL: unused (successor PCs live in the block)
+	uint32_t pc;         // PC of the (first) guest instruction, for JAL/JALR links and halts
+	uint8_t kind, rd, rs1, rs2;
+	uint8_t rd2, rs1b, rs2b; // second instruction of a fused pair
+};
+
+struct Block {
+	uint32_t start;      // PC of the first instruction
+	uint32_t length;     // guest instructions retired when the block runs to its end
+	vector<BlockOp> ops; // always ends with exactly one halt, branch, ADDI_BNE, jump or GOTO
+	Block* succ[2];      // chained successors: [0] taken / last JALR target, [1] fall-through
+	uint32_t succPC[2];  // the PCs those successors were chained for
+};
+
+static const unsigned MAX_BLOCK_OPS = 64;
+
+void CPU::runBlocks(uint64_t limit)
+{
+	// program[] always ends in a halt slot, so anything that leaves the program lands there
+	uint32_t n = program.size();
+
+#if defined(__GNUC__)
+	static const void* const labels[B_NUMKINDS] = {
+		&&do_HALT, &&do_NOP,
+		&&do_ADD, &&do_SUB, &&do_SLL, &&do_SLT, &&do_SLTU, &&do_XOR, &&do_SRL, &&do_SRA, &&do_OR, &&do_AND,
+		&&do_ADDI, &&do_SLTI, &&do_SLTIU, &&do_XORI, &&do_ORI, &&do_ANDI, &&do_SLLI, &&do_SRLI, &&do_SRAI,
+		&&do_LUI,
+		&&do_LB, &&do_LH, &&do_LW, &&do_LBU, &&do_LHU,
+		&&do_SB, &&do_SH, &&do_SW,
+		&&do_BEQ, &&do_BNE, &&do_BLT, &&do_BGE, &&do_BLTU, &&do_BGEU,
+		&&do_JAL, &&do_J, &&do_JALR, &&do_JR,
+		&&do_CSR,
+		&&do_LI2, &&do_ADDI_BNE, &&do_GOTO
+	};
+#define NEXT() goto *op->handler
+#else
+#define NEXT() goto dispatch
+#endif
+
+	deque<Block> blocks;             // owns every translated block (deque: pointers stay valid)
+	vector<Block*> cache(n, nullptr); // translation cache keyed by start PC
+	unsigned long version = codeVersion;
+
+	// clamp a computed PC into the program; anything outside runs into the halt slot
+	auto clampPC = [n](long pc) -> uint32_t {
+		return (pc < 0 || pc >= (long)n) ? n - 1 : (uint32_t)pc;
+	};
+
+	auto emit = [&](Block& b, uint8_t kind, const DecodedOp& d, uint32_t pc) -> BlockOp& {
+		BlockOp o = BlockOp();
+		o.kind = kind;
+		o.rd = d.rd;
+		o.rs1 = d.rs1;
+		o.rs2 = d.rs2;
+		o.imm = d.imm;
+		o.pc = pc;
+#if defined(__GNUC__)
+		o.handler = labels[kind];
+#endif
+		b.ops.push_back(o);
+		return b.ops.back();
+	};
+
+	auto translate = [&](uint32_t start) -> Block* {
+		blocks.push_back(Block());
+		Block& b = blocks.back();
+		b.start = start;
+		b.succ[0] = b.succ[1] = nullptr;
+		b.succPC[0] = b.succPC[1] = n - 1;
+
+		uint32_t i = start;
+		for (;;){
+			const DecodedOp& d = program[i];
+			uint8_t k = threadedKind(d);
+
+			if (k == T_NOP){
+				i++;
+				continue;
+			}
+			if (k == T_HALT || k == T_JALR || k == T_JR){
+				emit(b, k, d, i);
+				b.length = i - start + (k == T_HALT ? 0 : 1);
+				break;
+			}
+			if (isBranchKind(k) || k == T_JAL || k == T_J){
+				emit(b, k, d, i); // jumps only ever take [0]
+				b.succPC[0] = clampPC((long)i + d.imm/4);
+				b.succPC[1] = i + 1;
+				b.length = i - start + 1;
+				break;
+			}
+			if (b.ops.size() >= MAX_BLOCK_OPS){
+				emit(b, B_GOTO, d, i);
+				b.succPC[1] = i;
+				b.length = i - start;
+				break;
+			}
+
+			// LUI+ADDI / LUI+ORI building a constant: fold both results now
+			const DecodedOp& d2 = program[i + 1]; // safe: program[n-1] is a halt, so i + 1 < n here
+			uint8_t k2 = threadedKind(d2);
+			if (k == T_LUI && (k2 == T_ADDI || k2 == T_ORI) && d2.rs1 == d.rd){
+				BlockOp& o = emit(b, B_LI2, d, i);
+				o.rd2 = d2.rd;
+				o.imm2 = (k2 == T_ADDI) ? (int32_t)((uint32_t)d.imm + (uint32_t)d2.imm) : (d.imm | d2.imm);
+				i += 2;
+				continue;
+			}
+			// ADDI feeding the loop-closing BNE
+			if (k == T_ADDI && k2 == T_BNE){
+				BlockOp& o = emit(b, B_ADDI_BNE, d, i);
+				o.rs1b = d2.rs1;
+				o.rs2b = d2.rs2;
+				b.succPC[0] = clampPC((long)(i + 1) + d2.imm/4);
+				b.succPC[1] = i + 2;
+				b.length = i - start + 2;
+				break;
+			}
+
+			emit(b, k, d, i);
+			i++;
+		}
+		cache[start] = &b;
+		return &b;
+	};
+
+	auto lookup = [&](uint32_t pc) -> Block* {
+		return cache[pc] ? cache[pc] : translate(pc);
+	};
+
+	int* x = regfile;
+	uint64_t retired = 0; // whole blocks are counted when they finish, added to instret on the way out
+	Block* blk = lookup(clampPC((long)PC));
+	const BlockOp* op;
+
+enter:
+	if (retired + blk->length > limit){
+		goto out_of_budget;
+	}
+	op = blk->ops.data();
+#if !defined(__GNUC__)
+dispatch:
+	switch (op->kind){
+		case T_NOP: goto do_NOP;
+		case T_ADD: goto do_ADD;
+		case T_SUB: goto do_SUB;
+		case T_SLL: goto do_SLL;
+		case T_SLT: goto do_SLT;
+		case T_SLTU: goto do_SLTU;
+		case T_XOR: goto do_XOR;
+		case T_SRL: goto do_SRL;
+		case T_SRA: goto do_SRA;
+		case T_OR: goto do_OR;
+		case T_AND: goto do_AND;
+		case T_ADDI: goto do_ADDI;
+		case T_SLTI: goto do_SLTI;
+		case T_SLTIU: goto do_SLTIU;
+		case T_XORI: goto do_XORI;
+		case T_ORI: goto do_ORI;
+		case T_ANDI: goto do_ANDI;
+		case T_SLLI: goto do_SLLI;
+		case T_SRLI: goto do_SRLI;
+		case T_SRAI: goto do_SRAI;
+		case T_LUI: goto do_LUI;
+		case T_LB: goto do_LB;
+		case T_LH: goto do_LH;
+		case T_LW: goto do_LW;
+		case T_LBU: goto do_LBU;
+		case T_LHU: goto do_LHU;
+		case T_SB: goto do_SB;
+		case T_SH: goto do_SH;
+		case T_SW: goto do_SW;
+		case T_BEQ: goto do_BEQ;
+		case T_BNE: goto do_BNE;
+		case T_BLT: goto do_BLT;
+		case T_BGE: goto do_BGE;
+		case T_BLTU: goto do_BLTU;
+		case T_BGEU: goto do_BGEU;
+		case T_JAL: goto do_JAL;
+		case T_J: goto do_J;
+		case T_JALR: goto do_JALR;
+		case T_JR: goto do_JR;
+		case T_CSR: goto do_CSR;
+		case B_LI2: goto do_LI2;
+		case B_ADDI_BNE: goto do_ADDI_BNE;
+		case B_GOTO: goto do_GOTO;
+		default: goto do_HALT;
+	}
+#endif
+	NEXT();
+
+#define U(r) ((uint32_t)x[r])
+do_NOP:   op++; NEXT();
+do_ADD:   x[op->rd] = U(op->rs1) + U(op->rs2); op++; NEXT();
+do_SUB:   x[op->rd] = U(op->rs1) - U(op->rs2); op++; NEXT();
+do_SLL:   x[op->rd] = U(op->rs1) << (x[op->rs2] & 31); op++; NEXT();
+do_SLT:   x[op->rd] = x[op->rs1] < x[op->rs2]; op++; NEXT();
+do_SLTU:  x[op->rd] = U(op->rs1) < U(op->rs2); op++; NEXT();
+do_XOR:   x[op->rd] = x[op->rs1] ^ x[op->rs2]; op++; NEXT();
+do_SRL:   x[op->rd] = U(op->rs1) >> (x[op->rs2] & 31); op++; NEXT();
+do_SRA:   x[op->rd] = x[op->rs1] >> (x[op->rs2] & 31); op++; NEXT();
+do_OR:    x[op->rd] = x[op->rs1] | x[op->rs2]; op++; NEXT();
+do_AND:   x[op->rd] = x[op->rs1] & x[op->rs2]; op++; NEXT();
+do_ADDI:  x[op->rd] = U(op->rs1) + op->imm; op++; NEXT();
+do_SLTI:  x[op->rd] = x[op->rs1] < op->imm; op++; NEXT();
+do_SLTIU: x[op->rd] = U(op->rs1) < (uint32_t)op->imm; op++; NEXT();
+do_XORI:  x[op->rd] = x[op->rs1] ^ op->imm; op++; NEXT();
+do_ORI:   x[op->rd] = x[op->rs1] | op->imm; op++; NEXT();
+do_ANDI:  x[op->rd] = x[op->rs1] & op->imm; op++; NEXT();
+do_SLLI:  x[op->rd] = U(op->rs1) << op->imm; op++; NEXT();
+do_SRLI:  x[op->rd] = U(op->rs1) >> op->imm; op++; NEXT();
+do_SRAI:  x[op->rd] = x[op->rs1] >> op->imm; op++; NEXT();
+do_LUI:   x[op->rd] = op->imm; op++; NEXT();
+do_LI2:   x[op->rd] = op->imm; x[op->rd2] = op->imm2; op++; NEXT();
+do_CSR:   x[op->rd] = csrWord(op->imm, instret + retired + (op->pc - blk->start)); op++; NEXT();
+do_LB:    x[op->rd] = loadbyte(x[op->rs1] + op->imm); op++; NEXT();
+do_LH:    x[op->rd] = loadhalf(x[op->rs1] + op->imm); op++; NEXT();
+do_LW:    x[op->rd] = loadword(x[op->rs1] + op->imm); op++; NEXT();
+do_LBU:   x[op->rd] = loadbyteunsigned(x[op->rs1] + op->imm); op++; NEXT();
+do_LHU:   x[op->rd] = loadhalfunsigned(x[op->rs1] + op->imm); op++; NEXT();
+do_SB:    storebyte(x[op->rs1] + op->imm, x[op->rs2]); goto check_code;
+do_SH:    storehalf(x[op->rs1] + op->imm, x[op->rs2]); goto check_code;
+do_SW:    storeword(x[op->rs1] + op->imm, x[op->rs2]); goto check_code;
+check_code:
+	if (codeVersion != version){
+		// the rest of this block (or any other) may be stale: drop everything, resume after the store
+		PC = op->pc + 1;
+		retired += PC - blk->start;
+		blocks.clear();
+		cache.assign(n, nullptr);
+		version = codeVersion;
+		blk = lookup(PC);
+		goto enter;
+	}
+	op++;
+	NEXT();
+
+do_BEQ:  if (x[op->rs1] == x[op->rs2]) goto chain_taken; goto chain_fall;
+do_BNE:  if (x[op->rs1] != x[op->rs2]) goto chain_taken; goto chain_fall;
+do_BLT:  if (x[op->rs1] < x[op->rs2]) goto chain_taken; goto chain_fall;
+do_BGE:  if (x[op->rs1] >= x[op->rs2]) goto chain_taken; goto chain_fall;
+do_BLTU: if (U(op->rs1) < U(op->rs2)) goto chain_taken; goto chain_fall;
+do_BGEU: if (U(op->rs1) >= U(op->rs2)) goto chain_taken; goto chain_fall;
+do_JAL:
+	x[op->rd] = 4*op->pc + 4;
+do_J:
+	goto chain_taken;
+do_ADDI_BNE:
+	x[op->rd] = U(op->rs1) + op->imm;
+	if (x[op->rs1b] != x[op->rs2b]) goto chain_taken;
+	goto chain_fall;
+#undef U
+do_GOTO:
+	goto chain_fall;
+chain_taken:
+	retired += blk->length;
+	if (!blk->succ[0]){
+		blk->succ[0] = lookup(blk->succPC[0]);
+	}
+	blk = blk->succ[0];
+	goto enter;
+chain_fall:
+	retired += blk->length;
+	if (!blk->succ[1]){
+		blk->succ[1] = lookup(blk->succPC[1]);
+	}
+	blk = blk->succ[1];
+	goto enter;
+
+do_JALR: {
+	uint32_t target = clampPC((((uint32_t)x[op->rs1] + (uint32_t)op->imm) & ~1u) / 4);
+	x[op->rd] = 4*op->pc + 4;
+	PC = target;
+	goto indirect;
+}
+do_JR:
+	PC = clampPC((((uint32_t)x[op->rs1] + (uint32_t)op->imm) & ~1u) / 4);
+indirect:
+	retired += blk->length;
+	// one-entry inline cache on the block for the last indirect target
+	if (!blk->succ[0] || blk->succPC[0] != PC){
+		blk->succ[0] = lookup(PC);
+		blk->succPC[0] = PC;
+	}
+	blk = blk->succ[0];
+	goto enter;
+
+do_HALT:
+	PC = op->pc;
+	instret += retired + (op->pc - blk->start);
+	return;
+
+out_of_budget:
+	// the next block would go past the limit: step the rest one at a time
+	PC = blk->start;
+	instret += retired;
+	for (; retired < limit && step() != STEP_HALT; retired++){
+	}
+#undef NEXT
+}
@@ -0,0 +1,164 @@
+#include "BranchPredict.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+using namespace std;
+
+// CA2's predictor interface and TAGE (after our headers: branch.h defines OP_J* macros)
+#include "../CA2/src/branch.h"
+#include "../CA2/src/predictor.h"
+#include "../CA2/src/my_predictor.h"
+
+// 2-bit saturating counters indexed by PC
+class bimodal_predictor : public branch_predictor {
+public:
+	static const int BITS = 14;
+
+	bimodal_predictor() { memset(counters, 2, sizeof(counters)); } // weakly taken
+
+	branch_update* predict(branch_info& b)
+	{
+		index = (b.address >> 2) & ((1u << BITS) - 1);
+		cond = b.br_flags & BR_CONDITIONAL;
+		u.direction_prediction(!cond || counters[index] >= 2);
+		return &u;
+	}
+	void update(branch_update* up, bool taken, unsigned int target)
+	{
+		if (!cond) return;
+		unsigned char& c = counters[index];
+		if (taken && c < 3) c++;
+		else if (!taken && c > 0) c--;
+	}
+
+private:
+	branch_update u;
+	unsigned char counters[1 << BITS];
+	unsigned int index;
+	bool cond;
+};
+
+// static: conditional branches never taken (the fall-through fetch of a front end without a predictor)
+class not_taken_predictor : public branch_predictor {
+public:
+	branch_update* predict(branch_info& b)
+	{
+		u.direction_prediction(!(b.br_flags & BR_CONDITIONAL));
+		return &u;
+	}
+
+private:
+	branch_update u;
+};
+
+branch_predictor* makePredictor(const string& name)
+{
+	if (name == "tage") return new my_predictor();
+	if (name == "bimodal") return new bimodal_predictor();
+	if (name == "not-taken") return new not_taken_predictor();
+	return NULL;
+}
+
+FetchModel::FetchModel(const CPU& cpu, branch_predictor* predictor, unsigned penalty)
+	: predictor(predictor), penalty(penalty), branches(0), taken_(0), misses(0), jumps(0), indirect(0),
+	execs(cpu.program.size()), missed(cpu.program.size())
+{
+}
+
+void FetchModel::onBranch(uint32_t pc, const DecodedOp& op, bool taken, uint32_t next)
+{
+	// the branch_info CA2's trace reader would build from our CBP-2 record
+	branch_info bi;
+	bi.address = 4*pc;
+	bi.opcode = 0;
+	bi.br_flags = 0;
+	unsigned int target = 4*next;
+	bool cond = isBranch(op.opclass);
+	if (cond){
+		bi.opcode = cbpCondition(op);
+		bi.br_flags = BR_CONDITIONAL;
+		target = 4*pc + op.imm;
+	}
+	else{
+		switch (cbpJumpCode(op)){
+			case CBP_INDIRECT: bi.br_flags = BR_INDIRECT; break;
+			case CBP_CALL: bi.br_flags = BR_CALL; break;
+			case CBP_INDIRECT_CALL: bi.br_flags = BR_CALL | BR_INDIRECT; break;
+			case CBP_RETURN: bi.br_flags = BR_RETURN; break;
+			default: break; // plain jump
+		}
+	}
+
+	branch_update* u = predictor->predict(bi);
+	if (cond){
+		branches++;
+		execs[pc]++;
+		if (taken) taken_++;
+		if (u->direction_prediction() != taken){
+			misses++;
+			missed[pc]++;
+		}
+	}
+	else{
+		jumps++;
+		if (op.opclass == OP_JALR) indirect++;
+	}
+	predictor->update(u, taken, target);
+}
+
+void FetchModel::writeReport(ostream& out, const CPU& cpu, uint64_t instructions, size_t top) const
+{
+	out << fixed << setprecision(3);
+	out << "instructions        " << instructions << "\n";
+	out << "branches            " << branches << " (" << taken_ << " taken)\n";
+	out << "mispredictions      " << misses << " (accuracy "
+		<< (branches ? 100.0 * (branches - misses) / branches : 100.0) << "%)\n";
+	out << "MPKI                " << (instructions ? 1000.0 * misses / instructions : 0.0) << "\n";
+	out << "jumps               " << jumps << " (" << indirect << " JALR, not charged)\n";
+	out << "front-end penalty   " << penaltyCycles() << " cycles (" << penalty << " per miss, "
+		<< (instructions ? (double)penaltyCycles() / instructions : 0.0) << " per instruction)\n";
+
+	// branches that miss most
+	vector<uint32_t> pcs;
+	for (uint32_t pc = 0; pc < missed.size(); pc++){
+		if (missed[pc]) pcs.push_back(pc);
+	}
+	sort(pcs.begin(), pcs.end(), [this](uint32_t a, uint32_t b) { return missed[a] != missed[b] ? missed[a] > missed[b] : a < b; });
+	if (top && pcs.size() > top){
+		pcs.resize(top);
+	}
+	out << setprecision(2);
+	out << "\n     pc   address      word     executed      missed   miss%  of misses%\n";
+	for (size_t i = 0; i < pcs.size(); i++){
+		uint32_t pc = pcs[i];
+		out << setw(7) << pc << "  0x" << hex << setfill('0') << setw(6) << 4*pc << "  " << setw(8)
+			<< (pc < cpu.image.size() ? cpu.image[pc] : 0) << dec << setfill(' ') << setw(13) << execs[pc]
+			<< setw(12) << missed[pc] << setw(8) << 100.0 * missed[pc] / execs[pc]
+			<< setw(12) << 100.0 * missed[pc] / misses << "\n";
+	}
+}
+
+bool runBranchPredict(CPU& cpu, const string& predictor, unsigned penalty, const string& reportPath)
+{
+	branch_predictor* p = makePredictor(predictor);
+	if (!p){
+		cerr << "unknown branch predictor " << predictor << "\n";
+		return false;
+	}
+	uint64_t start = cpu.instret;
+	FetchModel fetch(cpu, p, penalty);
+	cpu.runObserved(fetch);
+	delete p;
+
+	ofstream out(reportPath.c_str());
+	if (!out){
+		cerr << "can't write branch report " << reportPath << "\n";
+		return false;
+	}
+	out << "branch predictor " << predictor << ", mispredict penalty " << penalty << " cycles\n";
+	fetch.writeReport(out, cpu, cpu.instret - start, 20);
+	return true;
+}
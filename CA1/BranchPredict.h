@@ -0,0 +1,48 @@
+#ifndef BRANCHPREDICT_H
+#define BRANCHPREDICT_H
+
+#include "Observer.h"
+
+#include <string>
+#include <vector>
+using namespace std;
+
+class branch_predictor; // CA2/src/predictor.h
+
+// a CBP-2 predictor by name: "tage" (CA2's my_predictor), "bimodal" (2-bit counters) or
+// "not-taken"; NULL for anything else
+branch_predictor* makePredictor(const string& name);
+
+/*
+Front end with a branch predictor, driven by the reference engine. Every branch and jump is handed to
+a CBP-2 predictor the way CA2's predict drives it from a trace: predict() with the branch_info before
+the outcome is known, update() with the outcome after. As in predict, only the direction of
+conditional branches is scored; each miss costs the front end penalty cycles. Jumps still go through
+the predictor (they shift its history) but the interface has no usable target prediction, so their
+redirects aren't charged.
+*/
+class FetchModel : public Observer {
+public:
+	FetchModel(const CPU& cpu, branch_predictor* predictor, unsigned penalty);
+
+	void onBranch(uint32_t pc, const DecodedOp& op, bool taken, uint32_t next);
+	uint64_t readCycle(const CPU& cpu) const { return cpu.instret + penaltyCycles(); } // one per instruction plus the misses
+
+	uint64_t mispredictions() const { return misses; }
+	uint64_t penaltyCycles() const { return misses * penalty; }
+	// totals, MPKI and penalty over the given instruction count, then the top worst branches
+	void writeReport(ostream& out, const CPU& cpu, uint64_t instructions, size_t top) const;
+
+private:
+	branch_predictor* predictor;
+	unsigned penalty;
+	uint64_t branches, taken_, misses;
+	uint64_t jumps, indirect; // JAL and JALR
+	vector<uint64_t> execs, missed; // per PC, conditional branches only
+};
+
+// run cpu to halt on the reference engine through predictor (a makePredictor name) with a
+// mispredict penalty of penalty cycles; report to the given file
+bool runBranchPredict(CPU& cpu, const string& predictor, unsigned penalty, const string& reportPath);
+
+#endif /* BRANCHPREDICT_H */
@@ -1,14 +1,17 @@
 #include "CPU.h"
+#include "Observer.h"
 
 CPU::CPU()
 {
 	PC = 0; //set PC to 0
-	for (int i = 0; i < 4096; i++) //copy instrMEM
+	codeBytes = 0;
+	codeVersion = 0;
+	instret = 0;
+	// set regfile x0..x31 -> 0
+	for (int i = 0; i < 32; i++)
 	{
-		dmemory[i] = (0);
+		regfile[i] = 0;
 	}
-	// set regfile x0 -> 0
-	regfile[0] = 0;
 }
 
 void CPU::setPC(int val){
@@ -25,279 +28,504 @@ void CPU::incPC()
 	PC++;
 }
 
-Instruction CPU::fetchInstruction(char* instMem)
+Instruction CPU::fetchInstruction()
 {
-	// Each instruction = 8 hex chars (32 bits)
-    int startIndex = PC * 8;  
-
-    string hexStr = "";
-
-    // Collect 8 characters in the correct little endianness order
-    for (int byte = 3; byte >= 0; --byte) {
-        int idx = startIndex + byte * 2;
-        hexStr += instMem[idx];
-        hexStr += instMem[idx + 1];
-    }
-	//cout << hexStr << endl;
-
-    // Convert hex string -> unsigned integer
-    unsigned int value = 0;
-    stringstream ss;
-    ss << std::hex << hexStr;
-    ss >> value;
-
-    // Create Instruction object from that integer
-    bitset<32> bits(value);
-    return Instruction(bits);
+	// the loader already turned the program into words; past the end reads as 0 (halt)
+	uint32_t value = (PC < image.size()) ? image[PC] : 0;
+	return Instruction(value);
 }
 
-void CPU::updateValuesInstructionDecode(Instruction myInst){
-	// read rs1 if not LUI (aluop != 1)
-	if (cpu_control.islui != 1){ 
-		rs1 = myInst.extractBits(19, 5, false);
-		//cout << "rs1: " << rs1 << endl;
-	}
-	// get rd if (regwrite = 1)
-	if (cpu_control.regwrite == 1){
-		rd = myInst.extractBits(11, 5, false);
-		//cout << "rd: " << rd << endl;
-	}
-	// ALUsrc mux logic
-	if (cpu_control.alusrc == 0){ // read rs2
-		rs2 = myInst.extractBits(24, 5, false);
-		// but if branch == 1 we need immediate too
-		//cout << "rs2: " << rs2 << endl;
-		if (cpu_control.branch == 1){ // BNE then we need immediate too
-			imm = myInst.extractBNEImmediate();
-		}
-		//cout << "imm: " << imm << endl;
-	}
-	else { // else alusrc == 1 then immediate
-		// if LUI then immediate is longer
-		//cout << myInst.instr << endl;
-		if (cpu_control.islui == 1){
-			imm = myInst.extractBits(31, 20, true);
+// instruction formats, i.e. which fields decode() pulls out of the word
+enum Format { F_NONE, F_R, F_I, F_SHAMT, F_S, F_B, F_U, F_J, F_CSR };
+
+struct DecodeEntry {
+	uint8_t opclass = OP_HALT; // for everything we don't support
+	uint8_t aluop = ALU_ADD;
+	uint8_t format = F_NONE;
+	bool strict = false;       // funct7 must be 0000000 (or 0100000 where bit 30 picks the op)
+};
+
+// the decode table, built at compile time. Index: opcode[6:2], funct3, funct7 bit 5 (instruction bit 30)
+struct DecodeTable {
+	DecodeEntry e[32 * 8 * 2];
+
+	constexpr DecodeTable() : e() {
+		for (int f3 = 0; f3 < 8; f3++){
+			set(0x37, f3, OP_LUI, ALU_ADD, F_U);
+			set(0x17, f3, OP_AUIPC, ALU_ADD, F_U);
+			set(0x6F, f3, OP_JAL, ALU_ADD, F_J);
+			set(0x0F, f3, OP_ITYPE, ALU_ADD, F_NONE); // FENCE/FENCE.I: nothing to order here, so a no-op
 		}
-		else if (cpu_control.issw == 1){ // if store word, immediate is different and we also need rs2
-			rs2 = myInst.extractBits(24, 5, false);
-			//cout << "rs2: " << rs2 << endl;
-			imm = myInst.extractSWImmediate();
+		// OP: funct3 picks the ALU op, bit 30 only tells ADD/SUB and SRL/SRA apart
+		const uint8_t rops[8] = {ALU_ADD, ALU_SLL, ALU_SLT, ALU_SLTU, ALU_XOR, ALU_SRL, ALU_OR, ALU_AND};
+		for (int f3 = 0; f3 < 8; f3++){
+			set(0x33, f3, 0, OP_RTYPE, rops[f3], F_R, true);
 		}
-		else{
-			if (cpu_control.branch == 1){ //JALR then we want unsigned result
-				imm = myInst.extractBits(31, 12, false);
-			}
-			else{
-				imm = myInst.extractBits(31, 12, true);
-			}
+		set(0x33, 0, 1, OP_RTYPE, ALU_SUB, F_R, true);
+		set(0x33, 5, 1, OP_RTYPE, ALU_SRA, F_R, true);
+		// OP-IMM: bit 30 is part of the immediate except for the shifts
+		for (int f3 = 0; f3 < 8; f3++){
+			if (f3 != 1 && f3 != 5) set(0x13, f3, OP_ITYPE, rops[f3], F_I);
 		}
-		//cout << "imm: " << imm << endl;
-	}
-}
+		set(0x13, 1, 0, OP_ITYPE, ALU_SLL, F_SHAMT, true);
+		set(0x13, 5, 0, OP_ITYPE, ALU_SRL, F_SHAMT, true);
+		set(0x13, 5, 1, OP_ITYPE, ALU_SRA, F_SHAMT, true);
+		set(0x03, 0, OP_LB, ALU_ADD, F_I);
+		set(0x03, 1, OP_LH, ALU_ADD, F_I);
+		set(0x03, 2, OP_LW, ALU_ADD, F_I);
+		set(0x03, 4, OP_LBU, ALU_ADD, F_I);
+		set(0x03, 5, OP_LHU, ALU_ADD, F_I);
+		set(0x23, 0, OP_SB, ALU_ADD, F_S);
+		set(0x23, 1, OP_SH, ALU_ADD, F_S);
+		set(0x23, 2, OP_SW, ALU_ADD, F_S);
+		set(0x63, 0, OP_BEQ, ALU_SUB, F_B);
+		set(0x63, 1, OP_BNE, ALU_SUB, F_B);
+		set(0x63, 4, OP_BLT, ALU_SLT, F_B);
+		set(0x63, 5, OP_BGE, ALU_SLT, F_B);
+		set(0x63, 6, OP_BLTU, ALU_SLTU, F_B);
+		set(0x63, 7, OP_BGEU, ALU_SLTU, F_B);
+		set(0x67, 0, OP_JALR, ALU_ADD, F_I);
+		// SYSTEM: only reads of the counters (decode() checks which CSR and that nothing is written);
+		// ECALL/EBREAK, CSRRW and everything else stays OP_HALT
+		set(0x73, 2, OP_CSR, ALU_ADD, F_CSR);
+		set(0x73, 3, OP_CSR, ALU_ADD, F_CSR);
+		set(0x73, 6, OP_CSR, ALU_ADD, F_CSR);
+		set(0x73, 7, OP_CSR, ALU_ADD, F_CSR);
+	}
+	constexpr void set(int opcode, int f3, int bit30, uint8_t opclass, uint8_t aluop, uint8_t format, bool strict) {
+		DecodeEntry& d = e[((opcode >> 2) & 31) << 4 | f3 << 1 | bit30];
+		d.opclass = opclass;
+		d.aluop = aluop;
+		d.format = format;
+		d.strict = strict;
+	}
+	constexpr void set(int opcode, int f3, uint8_t opclass, uint8_t aluop, uint8_t format) { // bit 30 doesn't matter
+		set(opcode, f3, 0, opclass, aluop, format, false);
+		set(opcode, f3, 1, opclass, aluop, format, false);
+	}
+};
 
+static constexpr DecodeTable decodeTable;
 
-void Controller::setController(bitset<7> opcode){ // given opcode will set the control bits accordingly
-	if (opcode.to_string() == "0110011") { // R TYPE
-		regwrite = 1; alusrc = 0; branch = 0; memre = 0; memwr = 0; memtoreg = 0; aluop = 0b10; islui = 0; issw = 0;
-	}
-	else if (opcode.to_string() == "0010011") { // I TYPE
-		regwrite = 1; alusrc = 1; branch = 0; memre = 0; memwr = 0; memtoreg = 0; aluop = 0b11; islui = 0; issw = 0;
-	}
-	else if (opcode.to_string() == "1100011") { // BNE
-		regwrite = 0; alusrc = 0; branch = 1; memre = 0; memwr = 0; memtoreg = 0; aluop = 0b01; islui = 0; issw = 0;
-	}
-	else if (opcode.to_string() == "1100111") { // JALR
-		regwrite = 1; alusrc = 1; branch = 1; memre = 0; memwr = 0; memtoreg = 0; aluop = 0b00; islui = 0; issw = 0;
-	}
-	else if (opcode.to_string() == "0000011") { // LW/LBU
-		regwrite = 1; alusrc = 1; branch = 0; memre = 1; memwr = 0; memtoreg = 1; aluop = 0b00; islui = 0; issw = 0;
+DecodedOp CPU::decode(uint32_t raw)
+{
+	DecodedOp op;
+	const DecodeEntry& e = decodeTable.e[((raw >> 2) & 31) << 4 | ((raw >> 12) & 7) << 1 | ((raw >> 30) & 1)];
+	// every 32-bit instruction ends in 11; a word of zeros (our halt) doesn't
+	if ((raw & 3) != 3 || e.opclass == OP_HALT || (e.strict && ((raw >> 25) & ~0x20u) != 0)){
+		return op;
 	}
-	else if (opcode.to_string() == "0100011") { // SW/SH
-		regwrite = 0; alusrc = 1; branch = 0; memre = 0; memwr = 1; memtoreg = 0; aluop = 0b00; islui = 0; issw = 1;
+
+	Instruction inst(raw);
+	op.opclass = e.opclass;
+	op.aluop = e.aluop;
+	switch (e.format){
+		case F_R: op.rd = inst.extractBits(11, 5, false); op.rs1 = inst.extractBits(19, 5, false); op.rs2 = inst.extractBits(24, 5, false); break;
+		case F_I: op.rd = inst.extractBits(11, 5, false); op.rs1 = inst.extractBits(19, 5, false); op.imm = inst.extractIImmediate(); break;
+		case F_SHAMT: op.rd = inst.extractBits(11, 5, false); op.rs1 = inst.extractBits(19, 5, false); op.imm = inst.extractBits(24, 5, false); break;
+		case F_S: op.rs1 = inst.extractBits(19, 5, false); op.rs2 = inst.extractBits(24, 5, false); op.imm = inst.extractSWImmediate(); break;
+		case F_B: op.rs1 = inst.extractBits(19, 5, false); op.rs2 = inst.extractBits(24, 5, false); op.imm = inst.extractBNEImmediate(); break;
+		case F_U: op.rd = inst.extractBits(11, 5, false); op.imm = inst.extractUImmediate(); break;
+		case F_J: op.rd = inst.extractBits(11, 5, false); op.imm = inst.extractJALImmediate(); break;
+		case F_CSR:
+			// the counters are read-only: setting or clearing bits (rs1/uimm != 0) would write them
+			if (!isCounterCSR(raw >> 20) || inst.extractBits(19, 5, false) != 0){
+				return DecodedOp();
+			}
+			op.rd = inst.extractBits(11, 5, false);
+			op.imm = raw >> 20;
+			break;
+		default: break; // F_NONE: all fields stay 0
 	}
-	else if (opcode.to_string() == "0110111") { // LUI aluop doesn't matter we use islui
-		regwrite = 1; alusrc = 1; branch = 0; memre = 0; memwr = 0; memtoreg = 0; aluop = 0b00; islui = 1; issw = 0;
+	return op;
+}
+
+// decode() plus what depends on where the word sits
+static DecodedOp decodeAt(CPU& cpu, uint32_t raw, size_t index)
+{
+	DecodedOp op = cpu.decode(raw);
+	if (op.opclass == OP_AUIPC){
+		op.imm += 4 * index;
 	}
+	return op;
 }
 
-bitset<7> Instruction::getOpCode(){
-	bitset<7> opcode;
+void CPU::predecode(const vector<uint32_t>& words)
+{
+	// one extra slot past the end so running off the program hits a halt
+	image = words;
+	program.assign(words.size() + 1, DecodedOp());
+	codeBytes = 4 * words.size();
+	mem.forget(); // the cached page may overlap the new image
 
-	for (int i = 0; i < 7; i++) {
-		opcode[i] = instr[i]; // copy bits 0–6
+	for (size_t i = 0; i < words.size(); i++){
+		program[i] = decodeAt(*this, words[i], i);
 	}
-	return opcode;
 }
-bitset<3> Instruction::getfunc3(){
-	bitset<3> func3;
 
-	for (int i = 0; i < 3; i++){
-		func3[i] = instr[12 + i];
+void CPU::reset()
+{
+	PC = 0;
+	instret = 0;
+	for (int i = 0; i < 32; i++){
+		regfile[i] = 0;
 	}
-	return func3;
+	mem.zero();
+	mem.forget();
 }
-bitset<7> Instruction::getfunc7(){
-	bitset<7> func7;
 
-	for (int i = 0; i < 7; i++){
-		func7[i] = instr[25 + i];
-	}
-	return func7;
+void CPU::writeCode(uint32_t address, uint32_t value, int bytes)
+{
+	// patch the raw image byte by byte, then re-decode every word that changed
+	for (int b = 0; b < bytes && address + b < codeBytes; b++){
+		uint32_t word = (address + b) / 4;
+		int shift = ((address + b) % 4) * 8;
+		image[word] = (image[word] & ~(0xFFu << shift)) | (((value >> (8 * b)) & 0xFF) << shift);
+		program[word] = decodeAt(*this, image[word], word);
+	}
+	codeVersion++;
 }
 
-int Instruction::extractBits(int start, int length, bool takesign) {
-    string s;
-	for (int i = 0; i < length; i++){
-		s += (instr[start - i] ? '1' : '0');
-	}
-	// << "extracted " << s << endl;
-	int value = std::stoi(s, nullptr, 2);
-	// if negative
-	if (takesign && s[0] == '1'){ // find 2's complement myself
-		value = value - (1LL << s.size());
-	}
-	return value;
+// the reference semantics live in stepObserved (Observer.h); these run it with no hooks
+int CPU::step()
+{
+	Observer none;
+	return stepObserved(none);
 }
 
-int Instruction::extractSWImmediate() {
-    string s;
-	for (int i = 0; i < 7; i++){
-		s += (instr[31 - i] ? '1' : '0');
-	}
-	for (int i = 0; i < 5; i++){
-		s += (instr[11 - i] ? '1' : '0');
+void CPU::runInterp(uint64_t limit)
+{
+	Observer none;
+	if (limit != UINT64_MAX){
+		for (uint64_t i = 0; i < limit && stepObserved(none) != STEP_HALT; i++){
+		}
+		return;
 	}
-	//cout << "extracted " << s << endl;
-	int value = std::stoi(s, nullptr, 2);
-	// if negative
-	if (s[0] == '1'){ // find 2's complement myself
-		value = value - (1LL << s.size());
+	while (stepObserved(none) != STEP_HALT) // processor's main loop. Each iteration is equal to one clock cycle.
+	{
 	}
-	return value;
 }
 
-int Instruction::extractBNEImmediate() {
-	string s;
-	s += (instr[31] ? '1' : '0'); //12
-	s += (instr[7] ? '1' : '0'); //11
-	for (int i = 0; i < 6; i++){ // 10-5
-		s += (instr[30 - i] ? '1' : '0');
-	}
-	for (int i = 0; i < 4; i++){ // 4-1
-		s += (instr[11 - i] ? '1' : '0');
-	}
-	
-	//cout << "extracted " << s << endl;
-	int value = std::stoi(s, nullptr, 2);
-	// if negative
-	if (s[0] == '1'){ // find 2's complement myself
-		value = value - (1LL << s.size());
-	}
-	return value;
+bool parseEngine(const string& name, Engine& engine)
+{
+	if (name == "interp") engine = ENGINE_INTERP;
+	else if (name == "threaded") engine = ENGINE_THREADED;
+	else if (name == "blocks") engine = ENGINE_BLOCKS;
+	else if (name == "jit") engine = ENGINE_JIT;
+	else return false;
+	return true;
 }
 
-void ALU_Control::setALUControl(int aluop, Instruction myInst){
-	// easy case if 00 or 01
-	if (aluop == 0b00){ // SW/LW/SH/JALR Type -> ADD
-		fourbitout = 0b0000;
-	}
-	else if (aluop == 0b01){ // BEQ Type -> SUB
-		fourbitout = 0b0100;
+bool CPU::halted()
+{
+	return PC >= program.size() || program[PC].opclass == OP_HALT;
+}
+
+bool CPU::run(Engine engine, bool lockstep, uint64_t limit)
+{
+	// every engine stops after exactly limit instructions
+	switch (engine){
+		case ENGINE_THREADED: runThreaded(limit); return true;
+		case ENGINE_BLOCKS: runBlocks(limit); return true;
+		case ENGINE_JIT: return runJIT(lockstep, limit);
+		default: runInterp(limit); return true;
 	}
-	else if (aluop == 0b10){ // R Type -> check func3
-		if (myInst.getfunc3().to_string() == "000"){  // ADD/SUB
-			// check func7: either ADD/SUB
-			if (myInst.getfunc7().to_string() == "0000000"){
-				fourbitout = 0b1000; // ADD
-			}
-			else{
-				fourbitout = 0b1001; // SUB
-			}
-		}
-		else if (myInst.getfunc3().to_string() == "110"){ // OR
-			fourbitout = 0b1010;
-		}
-		else if (myInst.getfunc3().to_string() == "111"){ // AND
-			fourbitout = 0b1011;
-		}
-		else if (myInst.getfunc3().to_string() == "101"){ // SRA
-			fourbitout = 0b0001;
-		}
+}
+
+// pick the threaded handler for a decoded instruction
+uint8_t threadedKind(const DecodedOp& op)
+{
+	static const uint8_t rkinds[] = {T_ADD, T_SUB, T_SLL, T_SLT, T_SLTU, T_XOR, T_SRL, T_SRA, T_OR, T_AND};
+	static const uint8_t ikinds[] = {T_ADDI, T_ADDI, T_SLLI, T_SLTI, T_SLTIU, T_XORI, T_SRLI, T_SRAI, T_ORI, T_ANDI};
+	switch (op.opclass){
+		case OP_RTYPE: return (op.rd == 0) ? T_NOP : rkinds[op.aluop];
+		case OP_ITYPE: return (op.rd == 0) ? T_NOP : ikinds[op.aluop];
+		case OP_LUI:
+		case OP_AUIPC: return (op.rd == 0) ? T_NOP : T_LUI;
+		case OP_LB: return (op.rd == 0) ? T_NOP : T_LB;
+		case OP_LH: return (op.rd == 0) ? T_NOP : T_LH;
+		case OP_LW: return (op.rd == 0) ? T_NOP : T_LW;
+		case OP_LBU: return (op.rd == 0) ? T_NOP : T_LBU;
+		case OP_LHU: return (op.rd == 0) ? T_NOP : T_LHU;
+		case OP_SB: return T_SB;
+		case OP_SH: return T_SH;
+		case OP_SW: return T_SW;
+		case OP_BEQ: return T_BEQ;
+		case OP_BNE: return T_BNE;
+		case OP_BLT: return T_BLT;
+		case OP_BGE: return T_BGE;
+		case OP_BLTU: return T_BLTU;
+		case OP_BGEU: return T_BGEU;
+		case OP_JAL: return (op.rd == 0) ? T_J : T_JAL;
+		case OP_JALR: return (op.rd == 0) ? T_JR : T_JALR;
+		case OP_CSR: return (op.rd == 0) ? T_NOP : T_CSR;
+		default: return T_HALT;
 	}
-	else if (aluop == 0b11){ // I Type -> check func3
-		if (myInst.getfunc3().to_string() == "000"){  // ADDI
-			fourbitout = 0b1100;
-		}
-		else if (myInst.getfunc3().to_string() == "110"){ // ORI
-			fourbitout = 0b1110;
-		}
-		else if (myInst.getfunc3().to_string() == "111"){ // ANDI
-			fourbitout = 0b1111;
-		}
-		else if (myInst.getfunc3().to_string() == "011"){ // SLTIU
-			fourbitout = 0b0010;
+}
+
+void CPU::runThreaded(uint64_t limit)
+{
+	// program[] always ends in a halt slot, so anything that leaves the program lands there
+	unsigned long n = program.size();
+	// the budget is checked at branches and jumps only, and at most n instructions run between two of
+	// those; stop once fewer than n are left and let the reference engine count out the rest
+	if (limit < n){
+		runInterp(limit);
+		return;
+	}
+	uint64_t stop = limit - n;
+	vector<ThreadedOp> ops(n);
+
+#if defined(__GNUC__)
+	static const void* const labels[T_NUMKINDS] = {
+		&&do_HALT, &&do_NOP,
+		&&do_ADD, &&do_SUB, &&do_SLL, &&do_SLT, &&do_SLTU, &&do_XOR, &&do_SRL, &&do_SRA, &&do_OR, &&do_AND,
+		&&do_ADDI, &&do_SLTI, &&do_SLTIU, &&do_XORI, &&do_ORI, &&do_ANDI, &&do_SLLI, &&do_SRLI, &&do_SRAI,
+		&&do_LUI,
+		&&do_LB, &&do_LH, &&do_LW, &&do_LBU, &&do_LHU,
+		&&do_SB, &&do_SH, &&do_SW,
+		&&do_BEQ, &&do_BNE, &&do_BLT, &&do_BGE, &&do_BLTU, &&do_BGEU,
+		&&do_JAL, &&do_J, &&do_JALR, &&do_JR,
+		&&do_CSR
+	};
+#define NEXT() goto *op->handler
+#else
+#define NEXT() goto dispatch
+#endif
+#define TRANSFER() if (retired >= stop) goto budget; NEXT()
+
+	int* x = regfile;
+	const ThreadedOp* base = ops.data();
+	const ThreadedOp* op;
+	unsigned long resume = PC < n ? PC : n - 1;
+	unsigned long version;
+	uint64_t retired = 0; // kept in a register, added to instret on the way out
+
+	// (re)translate everything; a store into the instruction image sends us back here
+retranslate:
+	version = codeVersion;
+	for (unsigned long i = 0; i < n; i++){
+		const DecodedOp& d = program[i];
+		ThreadedOp& t = ops[i];
+		t.kind = threadedKind(d);
+		t.rd = d.rd;
+		t.rs1 = d.rs1;
+		t.rs2 = d.rs2;
+		t.imm = d.imm;
+		if (isBranchKind(t.kind) || t.kind == T_JAL || t.kind == T_J){ // resolve the target once
+			long target = (long)i + d.imm/4;
+			t.imm = (target < 0 || target >= (long)n) ? (int32_t)(n - 1) : (int32_t)target;
 		}
+#if defined(__GNUC__)
+		t.handler = labels[t.kind];
+#else
+		t.handler = 0;
+#endif
 	}
+
+	op = base + resume;
+
+#if !defined(__GNUC__)
+dispatch:
+	switch (op->kind){
+		case T_NOP: goto do_NOP;
+		case T_ADD: goto do_ADD;
+		case T_SUB: goto do_SUB;
+		case T_SLL: goto do_SLL;
+		case T_SLT: goto do_SLT;
+		case T_SLTU: goto do_SLTU;
+		case T_XOR: goto do_XOR;
+		case T_SRL: goto do_SRL;
+		case T_SRA: goto do_SRA;
+		case T_OR: goto do_OR;
+		case T_AND: goto do_AND;
+		case T_ADDI: goto do_ADDI;
+		case T_SLTI: goto do_SLTI;
+		case T_SLTIU: goto do_SLTIU;
+		case T_XORI: goto do_XORI;
+		case T_ORI: goto do_ORI;
+		case T_ANDI: goto do_ANDI;
+		case T_SLLI: goto do_SLLI;
+		case T_SRLI: goto do_SRLI;
+		case T_SRAI: goto do_SRAI;
+		case T_LUI: goto do_LUI;
+		case T_LB: goto do_LB;
+		case T_LH: goto do_LH;
+		case T_LW: goto do_LW;
+		case T_LBU: goto do_LBU;
+		case T_LHU: goto do_LHU;
+		case T_SB: goto do_SB;
+		case T_SH: goto do_SH;
+		case T_SW: goto do_SW;
+		case T_BEQ: goto do_BEQ;
+		case T_BNE: goto do_BNE;
+		case T_BLT: goto do_BLT;
+		case T_BGE: goto do_BGE;
+		case T_BLTU: goto do_BLTU;
+		case T_BGEU: goto do_BGEU;
+		case T_JAL: goto do_JAL;
+		case T_J: goto do_J;
+		case T_JALR: goto do_JALR;
+		case T_JR: goto do_JR;
+		case T_CSR: goto do_CSR;
+		default: goto do_HALT;
+	}
+#endif
+	NEXT();
+
+#define U(r) ((uint32_t)x[r])
+do_NOP:   op++; retired++; NEXT();
+do_ADD:   x[op->rd] = U(op->rs1) + U(op->rs2); op++; retired++; NEXT();
+do_SUB:   x[op->rd] = U(op->rs1) - U(op->rs2); op++; retired++; NEXT();
+do_SLL:   x[op->rd] = U(op->rs1) << (x[op->rs2] & 31); op++; retired++; NEXT();
+do_SLT:   x[op->rd] = x[op->rs1] < x[op->rs2]; op++; retired++; NEXT();
+do_SLTU:  x[op->rd] = U(op->rs1) < U(op->rs2); op++; retired++; NEXT();
+do_XOR:   x[op->rd] = x[op->rs1] ^ x[op->rs2]; op++; retired++; NEXT();
+do_SRL:   x[op->rd] = U(op->rs1) >> (x[op->rs2] & 31); op++; retired++; NEXT();
+do_SRA:   x[op->rd] = x[op->rs1] >> (x[op->rs2] & 31); op++; retired++; NEXT();
+do_OR:    x[op->rd] = x[op->rs1] | x[op->rs2]; op++; retired++; NEXT();
+do_AND:   x[op->rd] = x[op->rs1] & x[op->rs2]; op++; retired++; NEXT();
+do_ADDI:  x[op->rd] = U(op->rs1) + op->imm; op++; retired++; NEXT();
+do_SLTI:  x[op->rd] = x[op->rs1] < op->imm; op++; retired++; NEXT();
+do_SLTIU: x[op->rd] = U(op->rs1) < (uint32_t)op->imm; op++; retired++; NEXT();
+do_XORI:  x[op->rd] = x[op->rs1] ^ op->imm; op++; retired++; NEXT();
+do_ORI:   x[op->rd] = x[op->rs1] | op->imm; op++; retired++; NEXT();
+do_ANDI:  x[op->rd] = x[op->rs1] & op->imm; op++; retired++; NEXT();
+do_SLLI:  x[op->rd] = U(op->rs1) << op->imm; op++; retired++; NEXT();
+do_SRLI:  x[op->rd] = U(op->rs1) >> op->imm; op++; retired++; NEXT();
+do_SRAI:  x[op->rd] = x[op->rs1] >> op->imm; op++; retired++; NEXT();
+do_LUI:   x[op->rd] = op->imm; op++; retired++; NEXT();
+do_CSR:   x[op->rd] = csrWord(op->imm, instret + retired); op++; retired++; NEXT();
+do_LB:    x[op->rd] = loadbyte(x[op->rs1] + op->imm); op++; retired++; NEXT();
+do_LH:    x[op->rd] = loadhalf(x[op->rs1] + op->imm); op++; retired++; NEXT();
+do_LW:    x[op->rd] = loadword(x[op->rs1] + op->imm); op++; retired++; NEXT();
+do_LBU:   x[op->rd] = loadbyteunsigned(x[op->rs1] + op->imm); op++; retired++; NEXT();
+do_LHU:   x[op->rd] = loadhalfunsigned(x[op->rs1] + op->imm); op++; retired++; NEXT();
+do_SB:    storebyte(x[op->rs1] + op->imm, x[op->rs2]); op++; retired++; goto check_code;
+do_SH:    storehalf(x[op->rs1] + op->imm, x[op->rs2]); op++; retired++; goto check_code;
+do_SW:    storeword(x[op->rs1] + op->imm, x[op->rs2]); op++; retired++; goto check_code;
+check_code:
+	if (codeVersion != version){
+		resume = op - base;
+		goto retranslate;
+	}
+	NEXT();
+do_BEQ:  op = (x[op->rs1] == x[op->rs2]) ? base + op->imm : op + 1; retired++; TRANSFER();
+do_BNE:  op = (x[op->rs1] != x[op->rs2]) ? base + op->imm : op + 1; retired++; TRANSFER();
+do_BLT:  op = (x[op->rs1] < x[op->rs2]) ? base + op->imm : op + 1; retired++; TRANSFER();
+do_BGE:  op = (x[op->rs1] >= x[op->rs2]) ? base + op->imm : op + 1; retired++; TRANSFER();
+do_BLTU: op = (U(op->rs1) < U(op->rs2)) ? base + op->imm : op + 1; retired++; TRANSFER();
+do_BGEU: op = (U(op->rs1) >= U(op->rs2)) ? base + op->imm : op + 1; retired++; TRANSFER();
+#undef U
+do_JAL:
+	x[op->rd] = 4*(op - base) + 4;
+do_J:
+	op = base + op->imm;
+	retired++;
+	TRANSFER();
+do_JALR: {
+	uint32_t target = (((uint32_t)x[op->rs1] + (uint32_t)op->imm) & ~1u) / 4;
+	x[op->rd] = 4*(op - base) + 4;
+	op = base + (target < n ? target : n - 1);
+	retired++;
+	TRANSFER();
+}
+do_JR: {
+	uint32_t target = (((uint32_t)x[op->rs1] + (uint32_t)op->imm) & ~1u) / 4;
+	op = base + (target < n ? target : n - 1);
+	retired++;
+	TRANSFER();
+}
+do_HALT:
+	PC = op - base;
+	instret += retired;
+	return;
+budget:
+	PC = op - base;
+	instret += retired;
+	runInterp(limit - retired);
+#undef TRANSFER
+#undef NEXT
 }
 
-void ALU::executeALU(int fourbit, int rs1, int rs2orimm, bool lui){
-	// LUI
-	if (lui == true){
-		alu_res = rs2orimm << 12;
-	}
+void ALU::executeALU(int aluop, int rs1, int rs2orimm){
+	// unsigned arithmetic so overflow wraps; only the low 5 bits of a shift amount count
+	uint32_t a = rs1, b = rs2orimm;
+	switch (aluop){
+		case ALU_SUB:  alu_res = a - b; break;
+		case ALU_SLL:  alu_res = a << (b & 31); break;
+		case ALU_SLT:  alu_res = (rs1 < rs2orimm) ? 1 : 0; break;
+		case ALU_SLTU: alu_res = (a < b) ? 1 : 0; break;
+		case ALU_XOR:  alu_res = a ^ b; break;
+		case ALU_SRL:  alu_res = a >> (b & 31); break;
+		case ALU_SRA:  alu_res = rs1 >> (b & 31); break;
+		case ALU_OR:   alu_res = a | b; break;
+		case ALU_AND:  alu_res = a & b; break;
+		default:       alu_res = a + b; break; // ALU_ADD
+	}
+	zero = (alu_res == 0);
+}
 
-	// ADD				LW/SW/SH				ADD						ADDI
-	else if (fourbit == 0b0000 || fourbit == 0b1000 || fourbit == 0b1100){
-		alu_res = rs1 + rs2orimm;
+// page for a data access; cached for the fast path unless the page overlaps the instruction image
+uint8_t* CPU::touch(uint32_t address){
+	uint8_t* page = mem.page(address);
+	if ((address & Memory::PAGE_MASK) >= codeBytes){
+		mem.cache(address, page);
 	}
-	// SUB             	BNE						SUB			
-	else if (fourbit == 0b0100 || fourbit == 0b1001){
-		alu_res = rs1 - rs2orimm;
-		zero = (alu_res == 0);
+	return page + (address & ~Memory::PAGE_MASK);
+}
+
+uint8_t CPU::readByte(uint32_t address){
+	if (address < codeBytes){ // reading the instruction image
+		return (image[address / 4] >> ((address % 4) * 8)) & 0xFF;
 	}
-	else if (fourbit == 0b0010) { // SLTIU
-		alu_res = ((unsigned int)rs1 < (unsigned int)rs2orimm) ? 1 : 0;
+	return *touch(address);
+}
+
+void CPU::writeByte(uint32_t address, uint8_t value){
+	if (address < codeBytes){ // self-modifying code
+		writeCode(address, value, 1);
+		return;
 	}
-	// AND				AND					ANDI
-	else if (fourbit == 0b1011 || fourbit == 0b1111){
-		alu_res = rs1 & rs2orimm;
+	*touch(address) = value;
+}
+
+// the slow paths: first touch of a page, misaligned accesses and the instruction image
+int CPU::loadwordSlow(uint32_t address){
+	if ((address & 3) == 0 && address >= codeBytes){
+		return loadWord(touch(address));
 	}
-	// OR				OR					ORI
-	else if (fourbit == 0b1010 || fourbit == 0b1110){
-		alu_res = rs1 | rs2orimm;
+	return readByte(address) | (readByte(address + 1) << 8)
+		| (readByte(address + 2) << 16) | ((uint32_t)readByte(address + 3) << 24);
+}
+
+void CPU::storewordSlow(uint32_t address, uint32_t value) {
+	if ((address & 3) == 0 && address >= codeBytes){
+		storeWord(touch(address), value);
+		return;
 	}
-	// SHIFT (SRA)
-	else if (fourbit == 0b0001){
-		alu_res = rs1 >> rs2orimm;
+	// Store least significant byte first (little-endian)
+	for (int b = 0; b < 4; b++){
+		writeByte(address + b, value >> (8 * b));
 	}
 }
 
-int CPU::loadword(uint32_t address){
-	address -= 65300;
-	uint32_t value = 0;
-    value |= (uint8_t)dmemory[address];
-    value |= (uint8_t)dmemory[address + 1] << 8;
-    value |= (uint8_t)dmemory[address + 2] << 16;
-    value |= (uint8_t)dmemory[address + 3] << 24;
-    return value;
+int CPU::loadbyteunsignedSlow(uint32_t address){
+	return readByte(address);
 }
 
-void CPU::storeword(uint32_t address, uint32_t value) {
-	address -= 65300;
-    // Store least significant byte first (little-endian)
-    dmemory[address]     = value & 0xFF;
-    dmemory[address + 1] = (value >> 8) & 0xFF;
-    dmemory[address + 2] = (value >> 16) & 0xFF;
-    dmemory[address + 3] = (value >> 24) & 0xFF;
+int CPU::loadhalfunsignedSlow(uint32_t address){
+	if ((address & 1) == 0 && address >= codeBytes){
+		return readLE16(touch(address));
+	}
+	return readByte(address) | (readByte(address + 1) << 8);
 }
 
-int CPU::loadbyteunsigned(uint32_t address){
-	address -= 65300;
-	return (uint8_t)dmemory[address];
+void CPU::storebyteSlow(uint32_t address, uint32_t value){
+	writeByte(address, value & 0xFF);
 }
 
-void CPU::storehalf(uint32_t address, uint32_t value){
-	address -= 65300;
-	dmemory[address]     = value & 0xFF;        // LSB
-    dmemory[address + 1] = (value >> 8) & 0xFF; // MSB
+void CPU::storehalfSlow(uint32_t address, uint32_t value){
+	writeByte(address, value & 0xFF);            // LSB
+	writeByte(address + 1, (value >> 8) & 0xFF); // MSB
 }
\ No newline at end of file
@@ -1,3 +1,6 @@
+#ifndef CPU_H
+#define CPU_H
+
 #include <iostream>
 #include <bitset>
 #include <stdio.h>
@@ -5,67 +8,243 @@
 #include <string>
 #include <sstream>
 #include <unordered_map>
+#include <vector>
 #include <cstdint>
+#include "Memory.h"
 using namespace std;
 
 
+// raw instruction word with its fields pulled out by shifts and masks (no branches)
 class Instruction { 
 public:
-	bitset<32> instr;//instruction
+	uint32_t instr;//instruction
  	Instruction() : instr(0) {} // default constructor
-	Instruction(bitset<32> bits) : instr(bits) {}
-	bitset<7> getOpCode();
-	bitset<3> getfunc3();
-	bitset<7> getfunc7();
-	int extractBits(int start, int length, bool takesign);
-	int extractSWImmediate();
-	int extractBNEImmediate();
+	Instruction(uint32_t bits) : instr(bits) {}
+	uint32_t getOpCode() const { return instr & 0x7F; }
+	uint32_t getfunc3() const { return (instr >> 12) & 0x7; }
+	uint32_t getfunc7() const { return instr >> 25; }
+	// bits [start, start-length+1], sign-extended if takesign
+	int extractBits(int start, int length, bool takesign) const {
+		uint32_t top = instr << (31 - start);
+		uint32_t sign = -(uint32_t)takesign;
+		return (int)((((uint32_t)((int32_t)top >> (32 - length))) & sign) | ((top >> (32 - length)) & ~sign));
+	}
+	int extractIImmediate() const { return (int32_t)instr >> 20; }
+	int extractSWImmediate() const { return (((int32_t)instr >> 25) << 5) | ((instr >> 7) & 0x1F); }
+	// B-type, as a byte offset
+	int extractBNEImmediate() const {
+		return (((int32_t)instr >> 31) << 12) | ((instr << 4) & 0x800) | ((instr >> 20) & 0x7E0) | ((instr >> 7) & 0x1E);
+	}
+	int extractUImmediate() const { return (int)(instr & 0xFFFFF000); }
+	// J-type, as a byte offset
+	int extractJALImmediate() const {
+		return (((int32_t)instr >> 31) << 20) | (instr & 0xFF000) | ((instr >> 9) & 0x800) | ((instr >> 20) & 0x7FE);
+	}
 };
 
-class Controller {
-public:
-	int regwrite, alusrc, branch, memre, memwr, memtoreg, aluop;
-	int islui, issw;
-	Controller() = default;
-	void setController(bitset<7> opcode);
-};
-
-class ALU_Control { // must check funct3/func7 and generate 4bit ALUoperation
-public:
-	int fourbitout;
-	ALU_Control() = default;
-	void setALUControl(int aluop, Instruction myInst);
+// ALU operations (the same for register and immediate forms)
+enum AluOp {
+	ALU_ADD = 0, ALU_SUB, ALU_SLL, ALU_SLT, ALU_SLTU, ALU_XOR, ALU_SRL, ALU_SRA, ALU_OR, ALU_AND
 };
 
 class ALU {
 public:
 	int zero, alu_res;
-	void executeALU(int fourbit, int rs1, int rs2orimm, bool lui);
+	void executeALU(int aluop, int rs1, int rs2orimm);
 	ALU() = default;
 };
 
+// instruction classes the predecoder sorts every word of the program into
+enum OpClass {
+	OP_HALT = 0, // opcode 0000000 (or anything we don't support) stops the processor
+	OP_RTYPE,    // ADD/SUB/SLL/SLT/SLTU/XOR/SRL/SRA/OR/AND
+	OP_ITYPE,    // ADDI/SLTI/SLTIU/XORI/ORI/ANDI/SLLI/SRLI/SRAI (and FENCE, as a no-op)
+	OP_LUI,
+	OP_AUIPC,
+	OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU,
+	OP_SB, OP_SH, OP_SW,
+	OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+	OP_JAL,
+	OP_JALR,
+	OP_CSR       // read of a counter CSR (CSRRS/CSRRC with x0, CSRRSI/CSRRCI with 0); imm is the CSR number
+};
+
+inline bool isLoad(uint8_t opclass) { return opclass >= OP_LB && opclass <= OP_LHU; }
+inline bool isStore(uint8_t opclass) { return opclass >= OP_SB && opclass <= OP_SW; }
+inline bool isBranch(uint8_t opclass) { return opclass >= OP_BEQ && opclass <= OP_BGEU; } // conditional ones
+
+// whether a conditional branch goes to its target
+inline bool branchTaken(uint8_t opclass, int32_t a, int32_t b)
+{
+	switch (opclass){
+		case OP_BEQ: return a == b;
+		case OP_BNE: return a != b;
+		case OP_BLT: return a < b;
+		case OP_BGE: return a >= b;
+		case OP_BLTU: return (uint32_t)a < (uint32_t)b;
+		default: return (uint32_t)a >= (uint32_t)b; // OP_BGEU
+	}
+}
+
+// the user-level counters a guest can read (rdcycle, rdtime, rdinstret and their high halves)
+enum CounterCSR {
+	CSR_CYCLE = 0xC00, CSR_TIME = 0xC01, CSR_INSTRET = 0xC02,
+	CSR_CYCLEH = 0xC80, CSR_TIMEH = 0xC81, CSR_INSTRETH = 0xC82
+};
+
+inline bool isCounterCSR(uint32_t csr) { return (csr & ~0x80u) >= CSR_CYCLE && (csr & ~0x80u) <= CSR_INSTRET; }
+inline bool isInstretCSR(uint32_t csr) { return (csr & ~0x80u) == CSR_INSTRET; }
+
+// the word of a 64-bit counter a CSR read returns (the ...H CSRs are the upper halves)
+inline int32_t csrWord(uint32_t csr, uint64_t value) { return (int32_t)((csr & 0x80) ? value >> 32 : value); }
+
+// one fully decoded instruction: everything the main loop needs without touching the raw bits again
+struct DecodedOp {
+	uint8_t opclass; // OpClass
+	uint8_t rd, rs1, rs2;
+	uint8_t aluop;   // AluOp
+	int32_t imm;     // sign-extended immediate (LUI: already shifted into place, AUIPC: the final value
+	                 // 4*PC + imm once it sits in program[], branches/JAL: byte offset)
+	DecodedOp() : opclass(OP_HALT), rd(0), rs1(0), rs2(0), aluop(0), imm(0) {}
+};
+
+// handler kinds for the threaded-code engine; every ALU op gets its own handler so nothing
+// about the instruction is decided again at run time
+enum ThreadedKind {
+	T_HALT = 0, T_NOP,
+	T_ADD, T_SUB, T_SLL, T_SLT, T_SLTU, T_XOR, T_SRL, T_SRA, T_OR, T_AND,
+	T_ADDI, T_SLTI, T_SLTIU, T_XORI, T_ORI, T_ANDI, T_SLLI, T_SRLI, T_SRAI,
+	T_LUI, // also AUIPC, whose value is known once it has a PC
+	T_LB, T_LH, T_LW, T_LBU, T_LHU,
+	T_SB, T_SH, T_SW,
+	T_BEQ, T_BNE, T_BLT, T_BGE, T_BLTU, T_BGEU,
+	T_JAL, T_J, // J: JAL with rd = x0
+	T_JALR, T_JR,
+	T_CSR, // counter read: instret (and, with no timing model, cycle = time = instret)
+	T_NUMKINDS
+};
+
+inline bool isBranchKind(uint8_t kind) { return kind >= T_BEQ && kind <= T_BGEU; }
+
+struct ThreadedOp {
+	const void* handler; // address of the handler label (computed goto builds)
+	int32_t imm;         // branches/JAL: index of the target instead of the offset
+	uint8_t kind, rd, rs1, rs2;
+};
+
+uint8_t threadedKind(const DecodedOp& op);
+
+// what CPU::step() did
+enum StepResult {
+	STEP_NEXT = 0, // fell through to PC + 1
+	STEP_BRANCH,   // executed a branch or jump
+	STEP_HALT
+};
+
+// execution engines selectable with -e
+enum Engine {
+	ENGINE_INTERP = 0,
+	ENGINE_THREADED,
+	ENGINE_BLOCKS,
+	ENGINE_JIT
+};
+
+bool parseEngine(const string& name, Engine& engine); // false for an unknown name
+
 class CPU {
 private:
-	char dmemory[70000]; //data memory byte addressable in little endian fashion;
+	Memory mem; //data memory, sparse pages over the whole 32-bit space, little endian
 	unsigned long PC; //pc 
 
 public:
 	CPU();
-	int rs1, rs2, rd, imm;
-	Controller cpu_control;
-	ALU_Control alu_control;
 	ALU alu;
-	unordered_map<int, int> regfile;
+	int regfile[32];
+	vector<DecodedOp> program; // predecoded instruction memory, indexed by PC
+	vector<uint32_t> image;    // raw instruction words, visible to loads/stores at byte addresses [0, codeBytes)
+	uint32_t codeBytes;
+	unsigned long codeVersion; // bumped by every store that lands in the instruction image
+	uint64_t instret;          // instructions retired so far, kept by every engine
 	
 	unsigned long readPC();
 	void setPC(int val);
 	void incPC();
-	Instruction fetchInstruction(char* instMem); // takes PC, instMem and returns Instruction object
-	void updateValuesInstructionDecode(Instruction myInst);
+	Instruction fetchInstruction(); // takes PC and returns the Instruction object from the image
+	DecodedOp decode(uint32_t raw); // table-driven, PC-independent (AUIPC's imm is still the offset)
+	void predecode(const vector<uint32_t>& words); // load the image and decode it once into program[]
+	void reset(); // registers, PC and instret to 0, data memory zeroed in place; the image stays as it is
+	void writeCode(uint32_t address, uint32_t value, int bytes); // store into the image + re-decode
+	int step();         // execute the instruction at PC (reference semantics), returns a StepResult
+	template <class O> int stepObserved(O& obs); // step() reporting to an observer (Observer.h)
+	template <class O> void runObserved(O& obs); // runInterp() with an observer
+	void runInterp(uint64_t limit = UINT64_MAX); // reference engine: step() until halt (or limit instructions)
+	void runThreaded(uint64_t limit = UINT64_MAX); // threaded-code engine: each instruction jumps straight to its own handler
+	void runBlocks(uint64_t limit = UINT64_MAX); // basic-block translation cache with superinstructions and chaining
+	bool runJIT(bool lockstep, uint64_t limit = UINT64_MAX); // x86-64 JIT for hot blocks; false if lockstep found a mismatch
+	bool run(Engine engine, bool lockstep, uint64_t limit = UINT64_MAX); // run to halt (or limit more instructions); false only on a lockstep mismatch
+	bool halted(); // PC is on a halt (or off the end of the program)
 	int loadword(uint32_t address);
 	void storeword(uint32_t address, uint32_t value);
 	void storehalf(uint32_t address, uint32_t value);
 	int loadbyteunsigned(uint32_t address);
+	int loadbyte(uint32_t address);
+	int loadhalf(uint32_t address);
+	int loadhalfunsigned(uint32_t address);
+	void storebyte(uint32_t address, uint32_t value);
+	Memory& memory() { return mem; }
+	const Memory& memory() const { return mem; }
+
+private:
+	uint8_t* touch(uint32_t address);
+	uint8_t readByte(uint32_t address);
+	void writeByte(uint32_t address, uint8_t value);
+	int loadwordSlow(uint32_t address);
+	void storewordSlow(uint32_t address, uint32_t value);
+	void storehalfSlow(uint32_t address, uint32_t value);
+	int loadbyteunsignedSlow(uint32_t address);
+	int loadhalfunsignedSlow(uint32_t address);
+	void storebyteSlow(uint32_t address, uint32_t value);
 };
 
+// memory helpers: inline fast path on the cached page, everything else goes to the slow path
+inline int CPU::loadword(uint32_t address){
+	if (mem.hit(address, 3)) return loadWord(mem.lastPtr(address));
+	return loadwordSlow(address);
+}
+
+inline void CPU::storeword(uint32_t address, uint32_t value){
+	if (mem.hit(address, 3)) storeWord(mem.lastPtr(address), value);
+	else storewordSlow(address, value);
+}
+
+inline void CPU::storehalf(uint32_t address, uint32_t value){
+	if (mem.hit(address, 1)) writeLE16(mem.lastPtr(address), value);
+	else storehalfSlow(address, value);
+}
+
+inline int CPU::loadbyteunsigned(uint32_t address){
+	if (mem.hit(address, 0)) return *mem.lastPtr(address);
+	return loadbyteunsignedSlow(address);
+}
+
+inline int CPU::loadbyte(uint32_t address){
+	return (int8_t)loadbyteunsigned(address);
+}
+
+inline int CPU::loadhalfunsigned(uint32_t address){
+	if (mem.hit(address, 1)) return readLE16(mem.lastPtr(address));
+	return loadhalfunsignedSlow(address);
+}
+
+inline int CPU::loadhalf(uint32_t address){
+	return (int16_t)loadhalfunsigned(address);
+}
+
+inline void CPU::storebyte(uint32_t address, uint32_t value){
+	if (mem.hit(address, 0)) *mem.lastPtr(address) = value;
+	else storebyteSlow(address, value);
+}
+
 // add other functions and objects here
+
+#endif /* CPU_H */
@@ -0,0 +1,237 @@
+#include "Cache.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+using namespace std;
+
+static bool powerOfTwo(uint32_t v) { return v && !(v & (v - 1)); }
+
+static unsigned log2of(uint32_t v)
+{
+	unsigned n = 0;
+	while ((1u << n) < v) n++;
+	return n;
+}
+
+bool parseCacheConfig(const string& text, CacheConfig& config)
+{
+	vector<string> fields;
+	stringstream in(text);
+	string f;
+	while (getline(in, f, ':')){
+		fields.push_back(f);
+	}
+	if (fields.size() < 3){
+		return false;
+	}
+	CacheConfig c = config;
+	char* end;
+	unsigned long size = strtoul(fields[0].c_str(), &end, 10);
+	if (*end == 'k' || *end == 'K') size <<= 10, end++;
+	else if (*end == 'm' || *end == 'M') size <<= 20, end++;
+	if (*end || end == fields[0].c_str()){
+		return false;
+	}
+	c.size = size;
+	c.assoc = atoi(fields[1].c_str());
+	c.line = atoi(fields[2].c_str());
+	for (size_t i = 3; i < fields.size(); i++){
+		if (fields[i] == "lru") c.repl = REPL_LRU;
+		else if (fields[i] == "fifo") c.repl = REPL_FIFO;
+		else if (fields[i] == "random") c.repl = REPL_RANDOM;
+		else if (fields[i] == "wb") c.writeBack = true;
+		else if (fields[i] == "wt") c.writeBack = false;
+		else return false;
+	}
+	// a line holds at least a word; sets must come out a whole power of two
+	if (!powerOfTwo(c.line) || c.line < 4 || c.assoc == 0 || (uint64_t)c.assoc * c.line > c.size
+		|| c.size % (c.assoc * c.line) || !powerOfTwo(c.size / (c.assoc * c.line))){
+		return false;
+	}
+	config = c;
+	return true;
+}
+
+CacheLevel::CacheLevel(const CacheConfig& config)
+	: config(config), writebacks(0), seed(0x9E3779B9)
+{
+	uint32_t sets = config.size / (config.assoc * config.line);
+	lineBits = log2of(config.line);
+	setMask = sets - 1;
+	tags.assign((size_t)sets * config.assoc, (uint32_t)EMPTY); // a copy: assign takes a reference
+	hits[0] = hits[1] = misses[0] = misses[1] = 0;
+}
+
+// put line (with its dirty bit) into way, which under LRU/FIFO is the last one and moves to the front
+void CacheLevel::fill(uint32_t* set, uint32_t way, uint32_t line, bool& evicted, uint32_t& victim)
+{
+	uint32_t old = set[way];
+	if (old != EMPTY && (old & DIRTY)){
+		evicted = true;
+		victim = (old & ~DIRTY) << lineBits;
+		writebacks++;
+	}
+	if (config.repl != REPL_RANDOM){
+		memmove(set + 1, set, way * sizeof(uint32_t));
+		way = 0;
+	}
+	set[way] = line;
+}
+
+bool CacheLevel::access(uint32_t address, bool write, bool& evicted, uint32_t& victim)
+{
+	uint32_t tag = address >> lineBits;
+	uint32_t* set = &tags[(size_t)(tag & setMask) * config.assoc];
+	uint32_t dirty = (write && config.writeBack) ? DIRTY : 0;
+	evicted = false;
+
+	// the front way is the most recently used (LRU) or filled (FIFO) line: check it first
+	if ((set[0] & ~DIRTY) == tag){
+		hits[write]++;
+		set[0] |= dirty;
+		return true;
+	}
+	// the rest without an early exit: no branch per way to mispredict
+	uint32_t hit = 0;
+	for (uint32_t w = 1; w < config.assoc; w++){
+		hit = ((set[w] & ~DIRTY) == tag) ? w : hit;
+	}
+	if (hit){
+		hits[write]++;
+		uint32_t line = set[hit] | dirty;
+		if (config.repl == REPL_LRU){ // move it to the front
+			memmove(set + 1, set, hit * sizeof(uint32_t));
+			hit = 0;
+		}
+		set[hit] = line;
+		return true;
+	}
+
+	misses[write]++;
+	if (write && !config.writeBack){ // no-write-allocate: the write just goes down
+		return false;
+	}
+	if (config.repl != REPL_RANDOM){
+		// the oldest line is at the back; empty ways fill from the back too, so they go first
+		fill(set, config.assoc - 1, tag | dirty, evicted, victim);
+		return false;
+	}
+	// random: an empty way if there is one
+	seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+	uint32_t way = seed % config.assoc;
+	for (uint32_t w = 0; w < config.assoc; w++){
+		if (set[w] == EMPTY){ way = w; break; }
+	}
+	fill(set, way, tag | dirty, evicted, victim);
+	return false;
+}
+
+CacheHierarchy::CacheHierarchy(const CPU& cpu, const CacheConfig& l1config, const CacheConfig* l2config, unsigned memLatency)
+	: l1(l1config), l2(l2config ? new CacheLevel(*l2config) : NULL), memLatency(memLatency), stalls(0),
+	accesses(cpu.program.size(), 0), l1misses(cpu.program.size(), 0)
+{
+}
+
+CacheHierarchy::~CacheHierarchy()
+{
+	delete l2;
+}
+
+void CacheHierarchy::accessSlow(uint32_t pc, uint32_t address, int bytes, bool write)
+{
+	uint32_t last = address + bytes - 1;
+	line(pc, address, write);
+	if ((last ^ address) >> l1.lineShift()){ // straddles two lines
+		line(pc, last, write);
+	}
+}
+
+void CacheHierarchy::line(uint32_t pc, uint32_t address, bool write)
+{
+	bool evicted, evicted2;
+	uint32_t victim, victim2;
+	bool hit = l1.access(address, write, evicted, victim);
+	if (evicted && l2){
+		l2->access(victim, true, evicted2, victim2);
+	}
+	if (write && !l1.config.writeBack){
+		// write-through: every write goes on to L2 (or memory) through the write buffer
+		l1.writebacks++;
+		if (l2) l2->access(address, true, evicted2, victim2);
+		if (!hit) l1misses[pc]++;
+		return;
+	}
+	if (hit){
+		return;
+	}
+	l1misses[pc]++;
+	// fetch the line (write-allocate misses too)
+	if (!l2){
+		stalls += memLatency;
+		return;
+	}
+	stalls += l2->config.latency;
+	if (!l2->access(address, false, evicted2, victim2)){
+		stalls += memLatency;
+	}
+}
+
+static void writeLevel(ostream& out, const char* name, const CacheLevel& c, bool latency)
+{
+	const CacheConfig& k = c.config;
+	static const char* const policies[] = { "LRU", "FIFO", "random" };
+	uint64_t hits = c.hits[0] + c.hits[1], misses = c.misses[0] + c.misses[1];
+	out << name << " " << k.size / 1024 << " KB, " << k.assoc << "-way, " << k.line << " B lines, "
+		<< policies[k.repl] << ", " << (k.writeBack ? "write-back/allocate" : "write-through/no-allocate")
+		<< (latency ? ", " + to_string(k.latency) + " cycles" : string()) << "\n";
+	out << "  accesses " << hits + misses << ", hits " << hits << ", misses " << misses
+		<< " (" << (hits + misses ? 100.0 * misses / (hits + misses) : 0.0) << "%)\n";
+	out << "  reads " << c.hits[0] + c.misses[0] << " (" << c.misses[0] << " missed), writes "
+		<< c.hits[1] + c.misses[1] << " (" << c.misses[1] << " missed), "
+		<< (k.writeBack ? "write-backs " : "writes through ") << c.writebacks << "\n";
+}
+
+void CacheHierarchy::writeReport(ostream& out, size_t top) const
+{
+	out << fixed << setprecision(2);
+	writeLevel(out, "L1D", l1, false);
+	if (l2){
+		writeLevel(out, "L2 ", *l2, true);
+	}
+	out << "memory " << memLatency << " cycles\n";
+	out << "estimated memory stall cycles " << stalls << "\n";
+
+	vector<uint32_t> pcs;
+	for (uint32_t pc = 0; pc < accesses.size(); pc++){
+		if (l1misses[pc]) pcs.push_back(pc);
+	}
+	sort(pcs.begin(), pcs.end(), [this](uint32_t a, uint32_t b) { return l1misses[a] != l1misses[b] ? l1misses[a] > l1misses[b] : a < b; });
+	if (top && pcs.size() > top){
+		pcs.resize(top);
+	}
+	out << "\n     pc   address     accesses    L1 misses   miss%\n";
+	for (size_t i = 0; i < pcs.size(); i++){
+		uint32_t pc = pcs[i];
+		out << setw(7) << pc << "  0x" << hex << setfill('0') << setw(6) << 4*pc << dec << setfill(' ')
+			<< setw(13) << accesses[pc] << setw(13) << l1misses[pc] << setw(8) << 100.0 * l1misses[pc] / accesses[pc] << "\n";
+	}
+}
+
+bool runCache(CPU& cpu, const CacheConfig& l1, const CacheConfig* l2, unsigned memLatency, const string& reportPath)
+{
+	CacheHierarchy caches(cpu, l1, l2, memLatency);
+	cpu.runObserved(caches);
+
+	ofstream out(reportPath.c_str());
+	if (!out){
+		cerr << "can't write cache report " << reportPath << "\n";
+		return false;
+	}
+	caches.writeReport(out, 50);
+	return true;
+}
@@ -0,0 +1,111 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "Observer.h"
+
+#include <string>
+using namespace std;
+
+enum Replacement { REPL_LRU = 0, REPL_FIFO, REPL_RANDOM };
+
+struct CacheConfig {
+	uint32_t size;        // bytes
+	uint32_t assoc;       // ways
+	uint32_t line;        // bytes per line
+	Replacement repl;
+	bool writeBack;       // write-back + write-allocate, or write-through + no-write-allocate
+	unsigned latency;     // cycles an L1 miss that hits here costs (unused for L1)
+	CacheConfig(uint32_t size, uint32_t assoc, uint32_t line, unsigned latency)
+		: size(size), assoc(assoc), line(line), repl(REPL_LRU), writeBack(true), latency(latency) {}
+};
+
+// "32k:8:64[:lru|fifo|random][:wb|wt]" (size, ways, line size); false if malformed or not a power-of-two geometry
+bool parseCacheConfig(const string& text, CacheConfig& config);
+
+/*
+One set-associative level. The tags of a set sit next to each other in one array, each with its
+dirty bit in the top bit, so a lookup reads one or two host cache lines and the compare loop over
+the ways is a straight scan. Under LRU and FIFO a set is kept in order, most recent first (use for
+LRU, fill for FIFO): the way at the front is checked before the scan, and the victim is always the
+last way, so a miss needs no search for it. Random replacement leaves the ways where they are.
+Tags are line addresses, EMPTY for an empty way.
+*/
+class CacheLevel {
+public:
+	CacheLevel(const CacheConfig& config);
+
+	// look the line up (and fill it on a miss, if the policy allocates); true on a hit. If a dirty
+	// line is thrown out, evicted is set and victim gets its address.
+	bool access(uint32_t address, bool write, bool& evicted, uint32_t& victim);
+	// the common case, inline: true (and counted as a hit) if the line is at the front of its set
+	bool hitFront(uint32_t address, bool write)
+	{
+		uint32_t tag = address >> lineBits;
+		uint32_t& front = tags[(size_t)(tag & setMask) * config.assoc];
+		if ((front & ~DIRTY) != tag){
+			return false;
+		}
+		hits[write]++;
+		if (write && config.writeBack) front |= DIRTY;
+		return true;
+	}
+
+	const CacheConfig config;
+	unsigned lineShift() const { return lineBits; }
+	uint64_t hits[2], misses[2]; // [0] reads, [1] writes
+	uint64_t writebacks;         // dirty lines evicted (write-back) or writes passed down (write-through)
+
+private:
+	static const uint32_t DIRTY = 1u << 31; // line addresses have at least two bits to spare
+	static const uint32_t EMPTY = ~0u;
+
+	uint32_t lineBits, setMask;
+	vector<uint32_t> tags; // sets x assoc, tag | DIRTY
+	uint32_t seed;
+
+	void fill(uint32_t* set, uint32_t way, uint32_t line, bool& evicted, uint32_t& victim);
+};
+
+/*
+L1D (and optionally L2) in front of memory, fed by the reference engine's loads and stores. An access
+that straddles a line touches both. Stall cycles are estimated from the latencies: an L1 miss costs
+the L2 latency, an L2 miss (or an L1 miss with no L2) the memory latency; write-backs and
+write-through traffic are assumed to drain from a write buffer and cost nothing.
+*/
+class CacheHierarchy : public Observer {
+public:
+	CacheHierarchy(const CPU& cpu, const CacheConfig& l1, const CacheConfig* l2, unsigned memLatency);
+	~CacheHierarchy();
+
+	void onLoad(uint32_t pc, uint32_t address, int bytes) { access(pc, address, bytes, false); }
+	void onStore(uint32_t pc, uint32_t address, int bytes) { access(pc, address, bytes, true); }
+	uint64_t readCycle(const CPU& cpu) const { return cpu.instret + stalls; } // one cycle per instruction plus the stalls
+
+	uint64_t stallCycles() const { return stalls; }
+	void writeReport(ostream& out, size_t top) const;
+
+private:
+	CacheLevel l1;
+	CacheLevel* l2; // NULL: L1 misses go straight to memory
+	unsigned memLatency;
+	uint64_t stalls;
+	vector<uint64_t> accesses, l1misses; // per PC
+
+	void access(uint32_t pc, uint32_t address, int bytes, bool write)
+	{
+		accesses[pc]++;
+		// most accesses hit the line at the front of its L1 set and need nothing else
+		bool straddles = ((address + bytes - 1) ^ address) >> l1.lineShift();
+		if (!straddles && (!write || l1.config.writeBack) && l1.hitFront(address, write)){
+			return;
+		}
+		accessSlow(pc, address, bytes, write);
+	}
+	void accessSlow(uint32_t pc, uint32_t address, int bytes, bool write);
+	void line(uint32_t pc, uint32_t address, bool write);
+};
+
+// run cpu to halt on the reference engine through the cache model; report to the given file
+bool runCache(CPU& cpu, const CacheConfig& l1, const CacheConfig* l2, unsigned memLatency, const string& reportPath);
+
+#endif /* CACHE_H */
@@ -0,0 +1,130 @@
+#include "Checkpoint.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+using namespace std;
+
+static const char MAGIC[8] = { 'C', 'P', 'U', 'S', 'I', 'M', 'C', 'K' };
+static const uint32_t VERSION = 1;
+
+static void put32(string& out, uint32_t v)
+{
+	uint8_t b[4];
+	writeLE32(b, v);
+	out.append((const char*)b, 4);
+}
+
+static void put64(string& out, uint64_t v)
+{
+	put32(out, (uint32_t)v);
+	put32(out, (uint32_t)(v >> 32));
+}
+
+// reads from a buffer without running off its end
+struct Reader {
+	const uint8_t* p;
+	const uint8_t* end;
+	bool ok;
+	bool take(size_t bytes) { ok = ok && (size_t)(end - p) >= bytes; return ok; }
+	uint32_t get32() { if (!take(4)) return 0; uint32_t v = readLE32(p); p += 4; return v; }
+	uint64_t get64() { uint64_t lo = get32(); return lo | ((uint64_t)get32() << 32); }
+};
+
+bool saveCheckpoint(CPU& cpu, const string& path)
+{
+	string out(MAGIC, sizeof(MAGIC));
+	put32(out, VERSION);
+	put32(out, cpu.readPC());
+	put64(out, cpu.instret);
+	for (int r = 0; r < 32; r++){
+		put32(out, cpu.regfile[r]);
+	}
+	put32(out, cpu.image.size());
+	for (size_t i = 0; i < cpu.image.size(); i++){
+		put32(out, cpu.image[i]);
+	}
+
+	// pages that are still all zero read back the same whether they exist or not
+	static const uint8_t zero[Memory::PAGE_SIZE] = { 0 };
+	string pages;
+	uint32_t count = 0;
+	cpu.memory().forEachPage([&](uint32_t base, const uint8_t* data) {
+		if (memcmp(data, zero, Memory::PAGE_SIZE) == 0) return;
+		put32(pages, base);
+		pages.append((const char*)data, Memory::PAGE_SIZE);
+		count++;
+	});
+	put32(out, count);
+	out += pages;
+
+	ofstream file(path.c_str(), ios::binary);
+	if (!file || !file.write(out.data(), out.size())){
+		cerr << "can't write checkpoint " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool loadCheckpoint(CPU& cpu, const string& path)
+{
+	ifstream file(path.c_str(), ios::binary);
+	if (!file){
+		cerr << "can't open checkpoint " << path << "\n";
+		return false;
+	}
+	string in((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	Reader r = { (const uint8_t*)in.data(), (const uint8_t*)in.data() + in.size(), true };
+
+	if (!r.take(sizeof(MAGIC)) || memcmp(r.p, MAGIC, sizeof(MAGIC)) != 0){
+		cerr << path << " is not a checkpoint\n";
+		return false;
+	}
+	r.p += sizeof(MAGIC);
+	if (r.get32() != VERSION){
+		cerr << path << ": unsupported checkpoint version\n";
+		return false;
+	}
+	uint32_t pc = r.get32();
+	uint64_t instret = r.get64();
+	int regs[32];
+	for (int i = 0; i < 32; i++){
+		regs[i] = r.get32();
+	}
+	uint32_t words = r.get32();
+	vector<uint32_t> image;
+	if (r.take(4ull * words)){
+		image.resize(words);
+		for (uint32_t i = 0; i < words; i++){
+			image[i] = r.get32();
+		}
+	}
+	if (!r.ok){
+		cerr << path << ": truncated checkpoint\n";
+		return false;
+	}
+
+	// the image decides codeBytes, so load it before any page lands in memory
+	cpu.memory().clear();
+	cpu.predecode(image);
+	uint32_t count = r.get32();
+	for (uint32_t i = 0; i < count && r.ok; i++){
+		uint32_t base = r.get32();
+		if (r.take(Memory::PAGE_SIZE)){
+			memcpy(cpu.memory().page(base), r.p, Memory::PAGE_SIZE);
+			r.p += Memory::PAGE_SIZE;
+		}
+	}
+	if (!r.ok){
+		cerr << path << ": truncated checkpoint\n";
+		return false;
+	}
+	for (int i = 0; i < 32; i++){
+		cpu.regfile[i] = regs[i];
+	}
+	cpu.regfile[0] = 0;
+	cpu.setPC(pc);
+	cpu.instret = instret;
+	return true;
+}
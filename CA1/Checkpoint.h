@@ -0,0 +1,21 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "CPU.h"
+
+#include <string>
+using namespace std;
+
+/*
+Binary checkpoints of a CPU: PC, instructions retired, the register file, the instruction image and
+every data page that isn't all zero. Everything is little-endian:
+	"CPUSIMCK"  u32 version  u32 PC  u64 instret  32 x u32 registers
+	u32 words  words x u32 image
+	u32 pages  pages x (u32 base address, 4096 bytes)
+Restoring decodes the image again, so the result runs on any engine. Both return false (with a
+message on stderr) if the file can't be written/read or isn't a checkpoint.
+*/
+bool saveCheckpoint(CPU& cpu, const string& path);
+bool loadCheckpoint(CPU& cpu, const string& path);
+
+#endif /* CHECKPOINT_H */
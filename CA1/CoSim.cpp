@@ -0,0 +1,199 @@
+#include "CoSim.h"
+#include "../CA3/procsim.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+using namespace std;
+
+InstQueue::InstQueue(size_t entries)
+	: head(0), tailSeen(0), pushStalls(0), pushSeconds(0), tail(0), headSeen(0), popStalls(0), popSeconds(0),
+	published(0), drained(0), closed(false)
+{
+	size_t size = 1024;
+	while (size < entries) size <<= 1;
+	ring.resize(size);
+	mask = size - 1;
+}
+
+void InstQueue::pushSlow(const CoSimInst& inst)
+{
+	tailSeen = drained.load(memory_order_acquire);
+	if (head - tailSeen > mask){
+		// full: make sure the timing side can see everything, then wait for it to make room
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		pushStalls++;
+		published.store(head, memory_order_release);
+		while (head - (tailSeen = drained.load(memory_order_acquire)) > mask){
+			this_thread::yield();
+		}
+		pushSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+	ring[head & mask] = inst;
+	head++;
+	published.store(head, memory_order_release);
+}
+
+void InstQueue::close()
+{
+	published.store(head, memory_order_release);
+	closed.store(true, memory_order_release);
+}
+
+bool InstQueue::refill()
+{
+	headSeen = published.load(memory_order_acquire);
+	if (tail != headSeen){
+		return true;
+	}
+	// empty: let the functional side see we've taken everything, then wait for more
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	drained.store(tail, memory_order_release);
+	bool more = true;
+	for (;;){
+		// closed first: once it's set, published already holds the last push
+		bool last = closed.load(memory_order_acquire);
+		headSeen = published.load(memory_order_acquire);
+		if (tail != headSeen){
+			break;
+		}
+		if (last){
+			more = false;
+			break;
+		}
+		this_thread::yield();
+	}
+	if (more){
+		popStalls++;
+		popSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+	return more;
+}
+
+void InstQueue::writeStats(ostream& out) const
+{
+	ios::fmtflags flags = out.flags();
+	streamsize precision = out.precision();
+	out << "queue of " << ring.size() << " entries: functional side stalled " << pushStalls << " times (" << fixed
+		<< setprecision(1) << pushSeconds * 1000 << " ms), timing side " << popStalls << " times ("
+		<< popSeconds * 1000 << " ms)\n";
+	out.flags(flags);
+	out.precision(precision);
+}
+
+CoSimFeeder::CoSimFeeder(const CPU& cpu, InstQueue& queue)
+	: cpu(cpu), queue(queue), insts(cpu.program.size()), known(cpu.program.size(), false), version(cpu.codeVersion)
+{
+}
+
+CoSimInst CoSimFeeder::convert(uint32_t pc, const DecodedOp& op)
+{
+	int dest, src1, src2;
+	procsimRegs(op, dest, src1, src2);
+	CoSimInst inst;
+	inst.address = 4*pc;
+	inst.opcode = procsimClass(op);
+	inst.dest = dest;
+	inst.src1 = src1;
+	inst.src2 = src2;
+	return inst;
+}
+
+CoSimConfig::CoSimConfig()
+	: r(DEFAULT_R), k0(DEFAULT_K0), k1(DEFAULT_K1), k2(DEFAULT_K2), f(DEFAULT_F), dispatchLimit(DISPATCH_AUTO),
+	queueEntries(InstQueue::DEFAULT_ENTRIES)
+{
+}
+
+uint64_t CoSimConfig::dispatchBound() const
+{
+	// procsim's RS holds 2 * (k0 + k1 + k2); a dispatch queue twice that keeps it fed
+	return dispatchLimit == DISPATCH_AUTO ? 4 * (k0 + k1 + k2) : dispatchLimit;
+}
+
+bool parseProcsimConfig(const string& text, CoSimConfig& config)
+{
+	istringstream in(text);
+	uint64_t value[5];
+	for (int i = 0; i < 5; i++){
+		char comma;
+		if (!(in >> value[i]) || value[i] == 0 || (i + 1 < 5 && !(in >> comma && comma == ','))){
+			return false;
+		}
+	}
+	char extra;
+	if (in >> extra){
+		return false;
+	}
+	config.r = value[0];
+	config.k0 = value[1];
+	config.k1 = value[2];
+	config.k2 = value[3];
+	config.f = value[4];
+	return true;
+}
+
+// where procsim's fetch stage gets its instructions while a co-simulation runs
+static InstQueue* g_feed = NULL;
+
+// procsim's front end (CA3/procsim_driver.cpp reads a trace file instead)
+bool read_instruction(proc_inst_t* p_inst)
+{
+	CoSimInst inst;
+	if (!g_feed || !g_feed->pop(inst)){
+		return false;
+	}
+	p_inst->instruction_address = inst.address;
+	p_inst->op_code = inst.opcode;
+	p_inst->dest_reg = inst.dest;
+	p_inst->src_reg[0] = inst.src1;
+	p_inst->src_reg[1] = inst.src2;
+	return true;
+}
+
+bool runCoSim(CPU& cpu, const CoSimConfig& config, uint64_t limit, const string& reportPath)
+{
+	ofstream out(reportPath.c_str());
+	if (!out){
+		cerr << "can't write co-simulation report " << reportPath << "\n";
+		return false;
+	}
+
+	InstQueue queue(config.queueEntries);
+	g_feed = &queue;
+	proc_stats_t stats;
+	memset(&stats, 0, sizeof(stats));
+	thread timing([&]{
+		setup_proc(config.r, config.k0, config.k1, config.k2, config.f);
+		set_proc_streaming(config.dispatchBound());
+		run_proc(&stats);
+		complete_proc(&stats);
+	});
+
+	CoSimFeeder feeder(cpu, queue);
+	uint64_t executed = 0;
+	while (executed < limit && cpu.stepObserved(feeder) != STEP_HALT){
+		executed++;
+	}
+	queue.close();
+	timing.join();
+	g_feed = NULL;
+
+	out << "procsim R=" << config.r << " k0=" << config.k0 << " k1=" << config.k1 << " k2=" << config.k2
+		<< " F=" << config.f << ", dispatch queue ";
+	if (config.dispatchBound()) out << "limited to " << config.dispatchBound() << "\n";
+	else out << "unlimited\n";
+	out << fixed << setprecision(3);
+	out << "instructions " << stats.retired_instruction << "\n";
+	out << "cycles       " << stats.cycle_count << "\n";
+	out << "IPC          " << (stats.cycle_count ? (double)stats.retired_instruction / stats.cycle_count : 0.0) << "\n";
+	out << "fired/cycle  " << stats.avg_inst_fired << "\n";
+	out << "dispatch queue average " << stats.avg_disp_size << ", maximum " << stats.max_disp_size << "\n";
+	queue.writeStats(out);
+	return true;
+}
@@ -0,0 +1,146 @@
+#ifndef COSIM_H
+#define COSIM_H
+
+#include "Observer.h"
+#include "Trace.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+// one instruction as CA3/procsim's read_instruction hands it over (see ProcsimTracer for the fields)
+struct CoSimInst {
+	uint32_t address;
+	int8_t opcode, dest, src1, src2;
+};
+
+/*
+Bounded single-producer/single-consumer queue between the functional simulator (push) and the
+procsim timing model (pop), on different threads. Each side works on its own copy of the other's
+position and only publishes its own every BATCH entries, or before it waits, so the two threads
+don't trade a cache line per instruction. A full queue holds the functional side back, an empty one
+the timing side; both kinds of wait are counted so a run can tell which simulator is the bottleneck.
+*/
+class InstQueue {
+public:
+	static const size_t DEFAULT_ENTRIES = 1 << 16;
+
+	InstQueue(size_t entries = DEFAULT_ENTRIES); // rounded up to a power of two, at least 1024
+
+	void push(const CoSimInst& inst)
+	{
+		if (head - tailSeen > mask){ // full as of our last look
+			pushSlow(inst);
+			return;
+		}
+		ring[head & mask] = inst;
+		if ((++head & (BATCH - 1)) == 0){
+			published.store(head, memory_order_release);
+		}
+	}
+	void close(); // publish what's left and end the stream
+
+	bool pop(CoSimInst& inst) // false once the stream has ended and everything has been taken
+	{
+		if (tail == headSeen && !refill()){
+			return false;
+		}
+		inst = ring[tail & mask];
+		if ((++tail & (BATCH - 1)) == 0){
+			drained.store(tail, memory_order_release);
+		}
+		return true;
+	}
+
+	// "queue of <n> entries: functional side stalled <n> times (<ms> ms), timing side <n> times (<ms> ms)"
+	void writeStats(ostream& out) const;
+
+private:
+	static const uint64_t BATCH = 64;
+
+	vector<CoSimInst> ring;
+	uint64_t mask;
+
+	// producer side
+	uint64_t head, tailSeen;
+	uint64_t pushStalls;
+	double pushSeconds;
+
+	// consumer side
+	uint64_t tail, headSeen;
+	uint64_t popStalls;
+	double popSeconds;
+
+	atomic<uint64_t> published, drained;
+	atomic<bool> closed;
+
+	void pushSlow(const CoSimInst& inst);
+	bool refill();
+
+	InstQueue(const InstQueue&);
+	InstQueue& operator=(const InstQueue&);
+};
+
+/*
+Feeds every executed instruction into an InstQueue in procsim's terms. Like ProcsimTracer the
+fields of each static instruction are worked out the first time it runs and reused after that.
+procsim runs behind on its own thread, so its cycle count when a guest reads cycle or time depends
+on thread timing; those reads get instret instead, as on the plain engines.
+*/
+class CoSimFeeder : public Observer {
+public:
+	CoSimFeeder(const CPU& cpu, InstQueue& queue);
+
+	uint64_t readCycle(const CPU& cpu) const { return cpu.instret; } // not procsim's cycles, see above
+
+	void onExec(uint32_t pc, const DecodedOp& op)
+	{
+		if (cpu.codeVersion != version){ // the program changed under us: work everything out again
+			known.assign(known.size(), false);
+			version = cpu.codeVersion;
+		}
+		if (!known[pc]){
+			insts[pc] = convert(pc, op);
+			known[pc] = true;
+		}
+		queue.push(insts[pc]);
+	}
+
+private:
+	const CPU& cpu;
+	InstQueue& queue;
+	vector<CoSimInst> insts;
+	vector<bool> known;
+	unsigned long version;
+
+	static CoSimInst convert(uint32_t pc, const DecodedOp& op);
+};
+
+// procsim's machine: the -r -j -k -l -f options of CA3/procsim
+struct CoSimConfig {
+	uint64_t r, k0, k1, k2, f;
+	uint64_t dispatchLimit; // fetch stalls while the dispatch queue holds this many, 0 = unlimited
+	size_t queueEntries;    // InstQueue size
+	CoSimConfig();
+
+	static const uint64_t DISPATCH_AUTO = UINT64_MAX; // the default: twice procsim's RS size
+	uint64_t dispatchBound() const; // dispatchLimit with DISPATCH_AUTO worked out
+};
+
+// parse "R,k0,k1,k2,F" (procsim's -r -j -k -l -f); false if it isn't five positive numbers
+bool parseProcsimConfig(const string& text, CoSimConfig& config);
+
+/*
+Co-simulation: cpu runs on the reference engine on this thread (to halt, or limit instructions) and
+every instruction it executes streams through an InstQueue into CA3's out-of-order model
+(setup_proc/run_proc) on a second thread, with no trace in between. The dispatch limit is what keeps
+memory bounded on long streams; only with it off (0) is the dispatch queue unbounded as in procsim
+proper, and only then is the cycle count guaranteed to be exactly what procsim gives for the
+--procsim-trace of the same run. procsim keeps its state in globals, so only one co-simulation can
+run at a time. Report to the given file.
+*/
+bool runCoSim(CPU& cpu, const CoSimConfig& config, uint64_t limit, const string& reportPath);
+
+#endif /* COSIM_H */
@@ -0,0 +1,92 @@
+#include "Harts.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+Harts::Harts(CPU& boot, unsigned count)
+{
+	harts.push_back(&boot);
+	for (unsigned id = 1; id < count; id++){
+		CPU* cpu = new CPU();
+		cpu->predecode(boot.image);
+		cpu->memory().share(boot.memory());
+		cpu->regfile[10] = id;
+		harts.push_back(cpu);
+	}
+}
+
+Harts::~Harts()
+{
+	for (size_t id = 1; id < harts.size(); id++){
+		delete harts[id];
+	}
+}
+
+// the turn of a deterministic run: which hart may go, and which have halted
+struct Turns {
+	mutex lock;
+	condition_variable changed;
+	unsigned turn;
+	vector<bool> halted;
+};
+
+static void takeTurns(CPU& cpu, unsigned id, Engine engine, uint64_t quantum, Turns& turns)
+{
+	unique_lock<mutex> hold(turns.lock);
+	for (;;){
+		turns.changed.wait(hold, [&] { return turns.turn == id; });
+		hold.unlock();
+		cpu.run(engine, false, quantum); // every engine stops after exactly quantum
+		bool halted = cpu.halted();
+		hold.lock();
+
+		// pass the turn to the next hart still running (ourselves again if we're the last one)
+		turns.halted[id] = halted;
+		unsigned n = turns.halted.size(), next = id;
+		for (unsigned k = 1; k <= n; k++){
+			if (!turns.halted[(id + k) % n]){
+				next = (id + k) % n;
+				break;
+			}
+		}
+		turns.turn = next;
+		turns.changed.notify_all();
+		if (halted){
+			return;
+		}
+	}
+}
+
+bool Harts::run(Engine engine, bool lockstep, uint64_t quantum)
+{
+	unsigned n = harts.size();
+	vector<thread> threads;
+	if (quantum == 0){
+		vector<char> ok(n, 1);
+		for (unsigned id = 1; id < n; id++){
+			threads.push_back(thread([this, id, engine, lockstep, &ok] { ok[id] = harts[id]->run(engine, lockstep); }));
+		}
+		ok[0] = harts[0]->run(engine, lockstep);
+		for (size_t t = 0; t < threads.size(); t++){
+			threads[t].join();
+		}
+		for (unsigned id = 0; id < n; id++){
+			if (!ok[id]) return false;
+		}
+		return true;
+	}
+
+	Turns turns;
+	turns.turn = 0;
+	turns.halted.assign(n, false);
+	for (unsigned id = 1; id < n; id++){
+		threads.push_back(thread(takeTurns, ref(*harts[id]), id, engine, quantum, ref(turns)));
+	}
+	takeTurns(*harts[0], 0, engine, quantum, turns);
+	for (size_t t = 0; t < threads.size(); t++){
+		threads[t].join();
+	}
+	return true;
+}
@@ -0,0 +1,41 @@
+#ifndef HARTS_H
+#define HARTS_H
+
+#include "CPU.h"
+
+#include <vector>
+using namespace std;
+
+/*
+Several harts running one program over shared data memory, one host thread per hart.
+Hart 0 is the CPU handed in (its memory becomes the shared memory); every other hart gets its own
+CPU with a copy of the program, PC 0 and a0 = its hart id, and shares hart 0's pages. Registers,
+PC and the instruction image are per hart: a store into the code region only changes that hart's
+copy of the program, everything from codeBytes up is shared.
+
+Aligned word loads and stores are single atomic accesses (acquire/release, see Memory.h), so
+flags and message passing between harts work without locks; FENCE stays a no-op. Free-running
+(quantum 0) the harts race each other at full speed, and a program that races gets host-dependent
+results. With a quantum the run is deterministic instead: the harts take turns, in hart order, each
+running quantum instructions before passing the turn on, until all of them have halted. Every run
+with the same quantum interleaves the same way, at the price of running one hart at a time.
+*/
+class Harts {
+public:
+	Harts(CPU& boot, unsigned count);
+	~Harts();
+
+	unsigned size() const { return harts.size(); }
+	CPU& hart(unsigned id) { return *harts[id]; }
+
+	// run every hart to halt; false if any lockstep check failed (free-running jit only)
+	bool run(Engine engine, bool lockstep, uint64_t quantum);
+
+private:
+	vector<CPU*> harts; // [0] is the boot CPU, the rest are ours
+
+	Harts(const Harts&);
+	Harts& operator=(const Harts&);
+};
+
+#endif /* HARTS_H */
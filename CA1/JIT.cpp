@@ -0,0 +1,356 @@
+#include "CPU.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+using namespace std;
+
+/*
+x86-64 JIT for RV32I.
+Blocks (straight-line code up to the next branch or jump) are interpreted with step() until they have
+started JIT_THRESHOLD times, then compiled into an mmap'd executable buffer. Guest registers stay in
+the pinned regfile array (rbx points at it), loads and stores call back into the CPU helpers, and
+every compiled block returns the next PC to the dispatcher. A halt (which covers every encoding the
+decoder doesn't support) and a counter CSR read end the block and are left to step().
+With lockstep on, a shadow CPU re-executes every compiled block with step() and the registers and
+PC are compared afterwards.
+*/
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#include <sys/mman.h>
+
+static const unsigned JIT_THRESHOLD = 16;       // block entries before we compile it
+static const unsigned JIT_MAX_BLOCK = 64;       // guest instructions per compiled block
+static const size_t JIT_BUFFER_SIZE = 16 << 20; // code buffer; flushed when full
+
+// a compiled block: returns the next PC and writes the number of guest instructions it retired
+typedef uint32_t (*JitBlock)(int* regs, CPU* cpu, uint32_t* executed);
+
+// memory helpers called from generated code (System V: rdi = cpu, esi = address, edx = value)
+static int jitLoadWord(CPU* cpu, uint32_t address) { return cpu->loadword(address); }
+static int jitLoadByte(CPU* cpu, uint32_t address) { return cpu->loadbyte(address); }
+static int jitLoadHalf(CPU* cpu, uint32_t address) { return cpu->loadhalf(address); }
+static int jitLoadByteUnsigned(CPU* cpu, uint32_t address) { return cpu->loadbyteunsigned(address); }
+static int jitLoadHalfUnsigned(CPU* cpu, uint32_t address) { return cpu->loadhalfunsigned(address); }
+// stores return nonzero if they landed in the instruction image
+static int jitStoreWord(CPU* cpu, uint32_t address, uint32_t value)
+{
+	unsigned long version = cpu->codeVersion;
+	cpu->storeword(address, value);
+	return cpu->codeVersion != version;
+}
+static int jitStoreHalf(CPU* cpu, uint32_t address, uint32_t value)
+{
+	unsigned long version = cpu->codeVersion;
+	cpu->storehalf(address, value);
+	return cpu->codeVersion != version;
+}
+static int jitStoreByte(CPU* cpu, uint32_t address, uint32_t value)
+{
+	unsigned long version = cpu->codeVersion;
+	cpu->storebyte(address, value);
+	return cpu->codeVersion != version;
+}
+
+// register numbers as they appear in ModRM
+enum { EAX = 0, ECX = 1, EDX = 2, ESI = 6 };
+
+class Emitter {
+public:
+	uint8_t* p;
+	Emitter(uint8_t* start) : p(start) {}
+
+	void byte(uint8_t b) { *p++ = b; }
+	void u32(uint32_t v) { memcpy(p, &v, 4); p += 4; }
+	void u64(uint64_t v) { memcpy(p, &v, 8); p += 8; }
+
+	// <op> reg, [rbx + 4*guest]  (also mov [rbx + 4*guest], reg with op = 0x89)
+	void regMem(uint8_t op, int reg, int guest) { byte(op); byte(0x43 | (reg << 3)); byte(4 * guest); }
+	void load(int reg, int guest) { regMem(0x8B, reg, guest); }
+	void store(int reg, int guest) { regMem(0x89, reg, guest); }
+	void storeImm(int guest, uint32_t imm) { byte(0xC7); byte(0x43); byte(4 * guest); u32(imm); }
+	void movImm(int reg, uint32_t imm) { byte(0xB8 + reg); u32(imm); }
+	// ecx = (eax <cc> second operand) after a cmp: xor ecx, ecx goes first since it clobbers the flags
+	void setcc(uint8_t cc) { byte(0x0F); byte(0x90 | cc); byte(0xC1); }
+	// shift eax (ext 4 = shl, 5 = shr, 7 = sar) by cl or by an immediate
+	void shiftCl(int ext) { byte(0xD3); byte(0xC0 | (ext << 3)); }
+	void shiftImm(int ext, uint8_t amount) { byte(0xC1); byte(0xC0 | (ext << 3)); byte(amount); }
+
+	void prologue()
+	{
+		byte(0x53);                           // push rbx
+		byte(0x41); byte(0x54);               // push r12
+		byte(0x41); byte(0x55);               // push r13 (also realigns rsp for calls)
+		byte(0x48); byte(0x89); byte(0xFB);   // mov rbx, rdi  (guest registers)
+		byte(0x49); byte(0x89); byte(0xF4);   // mov r12, rsi  (CPU*)
+		byte(0x49); byte(0x89); byte(0xD5);   // mov r13, rdx  (executed count out)
+	}
+	// leave with eax = next PC and *executed = count
+	void exit(uint32_t count)
+	{
+		byte(0x41); byte(0xC7); byte(0x45); byte(0x00); u32(count); // mov dword [r13], count
+		byte(0x41); byte(0x5D);               // pop r13
+		byte(0x41); byte(0x5C);               // pop r12
+		byte(0x5B);                           // pop rbx
+		byte(0xC3);                           // ret
+	}
+	void exitTo(uint32_t pc, uint32_t count) { movImm(EAX, pc); exit(count); }
+
+	// call fn(cpu, [rs1] + imm[, [rs2]]), result in eax
+	void callMem(void* fn, int rs1, int32_t imm, int rs2)
+	{
+		byte(0x4C); byte(0x89); byte(0xE7);   // mov rdi, r12
+		load(ESI, rs1);
+		byte(0x81); byte(0xC6); u32(imm);     // add esi, imm32
+		if (rs2 >= 0){
+			load(EDX, rs2);
+		}
+		byte(0x48); byte(0xB8); u64((uint64_t)(uintptr_t)fn); // mov rax, fn
+		byte(0xFF); byte(0xD0);               // call rax
+	}
+};
+
+// translate the block starting at start; returns false if the buffer is too full to hold it
+static bool compileBlock(const vector<DecodedOp>& program, uint32_t start, uint8_t*& cursor, uint8_t* end, JitBlock& out)
+{
+	// worst case per guest instruction is a store (~60 bytes), so reserve generously
+	if (end - cursor < (long)(JIT_MAX_BLOCK * 80 + 64)){
+		return false;
+	}
+	uint32_t n = program.size();
+	Emitter e(cursor);
+	e.prologue();
+
+	uint32_t i = start;
+	for (;;){
+		const DecodedOp& d = program[i];
+		uint8_t k = threadedKind(d);
+		uint32_t count = i - start; // instructions retired before this one
+
+		if (k == T_HALT || k == T_CSR || count >= JIT_MAX_BLOCK){
+			e.exitTo(i, count); // step() takes it from here
+			break;
+		}
+
+		switch (k){
+			case T_NOP: break;
+			case T_ADD: e.load(EAX, d.rs1); e.regMem(0x03, EAX, d.rs2); e.store(EAX, d.rd); break;
+			case T_SUB: e.load(EAX, d.rs1); e.regMem(0x2B, EAX, d.rs2); e.store(EAX, d.rd); break;
+			case T_XOR: e.load(EAX, d.rs1); e.regMem(0x33, EAX, d.rs2); e.store(EAX, d.rd); break;
+			case T_OR:  e.load(EAX, d.rs1); e.regMem(0x0B, EAX, d.rs2); e.store(EAX, d.rd); break;
+			case T_AND: e.load(EAX, d.rs1); e.regMem(0x23, EAX, d.rs2); e.store(EAX, d.rd); break;
+			case T_SLL:
+			case T_SRL:
+			case T_SRA:
+				e.load(EAX, d.rs1);
+				e.load(ECX, d.rs2);
+				e.shiftCl(k == T_SLL ? 4 : k == T_SRL ? 5 : 7); // x86 masks the count to 5 bits like RV32
+				e.store(EAX, d.rd);
+				break;
+			case T_SLT:
+			case T_SLTU:
+				e.load(EAX, d.rs1);
+				e.byte(0x31); e.byte(0xC9);             // xor ecx, ecx
+				e.regMem(0x3B, EAX, d.rs2);             // cmp eax, [rs2]
+				e.setcc(k == T_SLT ? 0xC : 0x2);        // setl / setb cl
+				e.store(ECX, d.rd);
+				break;
+			case T_ADDI: e.load(EAX, d.rs1); e.byte(0x05); e.u32(d.imm); e.store(EAX, d.rd); break;
+			case T_XORI: e.load(EAX, d.rs1); e.byte(0x35); e.u32(d.imm); e.store(EAX, d.rd); break;
+			case T_ORI:  e.load(EAX, d.rs1); e.byte(0x0D); e.u32(d.imm); e.store(EAX, d.rd); break;
+			case T_ANDI: e.load(EAX, d.rs1); e.byte(0x25); e.u32(d.imm); e.store(EAX, d.rd); break;
+			case T_SLLI: e.load(EAX, d.rs1); e.shiftImm(4, d.imm); e.store(EAX, d.rd); break;
+			case T_SRLI: e.load(EAX, d.rs1); e.shiftImm(5, d.imm); e.store(EAX, d.rd); break;
+			case T_SRAI: e.load(EAX, d.rs1); e.shiftImm(7, d.imm); e.store(EAX, d.rd); break;
+			case T_SLTI:
+			case T_SLTIU:
+				e.load(EAX, d.rs1);
+				e.byte(0x31); e.byte(0xC9);             // xor ecx, ecx
+				e.byte(0x3D); e.u32(d.imm);             // cmp eax, imm32
+				e.setcc(k == T_SLTI ? 0xC : 0x2);       // setl / setb cl
+				e.store(ECX, d.rd);
+				break;
+			case T_LUI: e.storeImm(d.rd, d.imm); break;
+			case T_LB:  e.callMem((void*)jitLoadByte, d.rs1, d.imm, -1); e.store(EAX, d.rd); break;
+			case T_LH:  e.callMem((void*)jitLoadHalf, d.rs1, d.imm, -1); e.store(EAX, d.rd); break;
+			case T_LW:  e.callMem((void*)jitLoadWord, d.rs1, d.imm, -1); e.store(EAX, d.rd); break;
+			case T_LBU: e.callMem((void*)jitLoadByteUnsigned, d.rs1, d.imm, -1); e.store(EAX, d.rd); break;
+			case T_LHU: e.callMem((void*)jitLoadHalfUnsigned, d.rs1, d.imm, -1); e.store(EAX, d.rd); break;
+			case T_SB:
+			case T_SH:
+			case T_SW: {
+				e.callMem((k == T_SW) ? (void*)jitStoreWord : (k == T_SH) ? (void*)jitStoreHalf : (void*)jitStoreByte,
+					d.rs1, d.imm, d.rs2);
+				// the store hit the instruction image: leave so the dispatcher can flush
+				e.byte(0x85); e.byte(0xC0);             // test eax, eax
+				e.byte(0x74); e.byte(0x00);             // jz over the exit
+				uint8_t* patch = e.p;
+				e.exitTo(i + 1, count + 1);
+				patch[-1] = (uint8_t)(e.p - patch);
+				break;
+			}
+			case T_BEQ:
+			case T_BNE:
+			case T_BLT:
+			case T_BGE:
+			case T_BLTU:
+			case T_BGEU: {
+				// condition codes: e, ne, l, ge, b, ae
+				static const uint8_t cc[6] = { 0x4, 0x5, 0xC, 0xD, 0x2, 0x3 };
+				long target = (long)i + d.imm/4;
+				uint32_t taken = (target < 0 || target >= (long)n) ? n - 1 : (uint32_t)target;
+				e.load(EAX, d.rs1);
+				e.regMem(0x3B, EAX, d.rs2);             // cmp eax, [rs2]
+				e.movImm(EAX, i + 1);
+				e.movImm(ECX, taken);
+				e.byte(0x0F); e.byte(0x40 | cc[k - T_BEQ]); e.byte(0xC1); // cmov<cc> eax, ecx
+				e.exit(count + 1);
+				break;
+			}
+			case T_JAL:
+			case T_J: {
+				long target = (long)i + d.imm/4;
+				if (k == T_JAL){
+					e.storeImm(d.rd, 4*i + 4);
+				}
+				e.exitTo((target < 0 || target >= (long)n) ? n - 1 : (uint32_t)target, count + 1);
+				break;
+			}
+			case T_JALR:
+			case T_JR:
+				e.load(EAX, d.rs1);
+				e.byte(0x05); e.u32(d.imm);             // add eax, imm32
+				e.byte(0x83); e.byte(0xE0); e.byte(0xFE); // and eax, ~1
+				e.byte(0xC1); e.byte(0xE8); e.byte(0x02); // shr eax, 2
+				if (k == T_JALR){
+					e.storeImm(d.rd, 4*i + 4);
+				}
+				e.exit(count + 1);
+				break;
+		}
+		if (isBranchKind(k) || k == T_JAL || k == T_J || k == T_JALR || k == T_JR){
+			break;
+		}
+		i++;
+	}
+
+	out = (JitBlock)cursor;
+	cursor = e.p;
+	return true;
+}
+
+// re-run what the compiled block just did on the shadow CPU and compare
+static bool lockstepCheck(CPU& cpu, CPU& shadow, uint32_t start, uint32_t executed)
+{
+	for (uint32_t k = 0; k < executed; k++){
+		shadow.step();
+	}
+	bool ok = (shadow.readPC() == cpu.readPC());
+	for (int r = 0; r < 32; r++){
+		ok = ok && (shadow.regfile[r] == cpu.regfile[r]);
+	}
+	if (!ok){
+		cerr << "lockstep mismatch in block at PC " << start << " after " << executed << " instructions\n";
+		cerr << "  PC: jit " << cpu.readPC() << " interp " << shadow.readPC() << "\n";
+		for (int r = 0; r < 32; r++){
+			if (shadow.regfile[r] != cpu.regfile[r]){
+				cerr << "  x" << r << ": jit " << cpu.regfile[r] << " interp " << shadow.regfile[r] << "\n";
+			}
+		}
+	}
+	return ok;
+}
+
+bool CPU::runJIT(bool lockstep, uint64_t limit)
+{
+	uint8_t* buffer = (uint8_t*)mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer == MAP_FAILED){ // no executable memory on this host: interpret everything
+		runThreaded(limit);
+		return true;
+	}
+
+	uint32_t n = program.size();
+	// a compiled block retires at most JIT_MAX_BLOCK, an interpreted stretch at most n; once fewer than
+	// that are left the reference engine counts out the rest
+	uint64_t slack = max<uint64_t>(n, JIT_MAX_BLOCK), begin = instret;
+	vector<JitBlock> code(n, NULL);
+	vector<uint32_t> heat(n, 0);
+	uint8_t* cursor = buffer;
+	unsigned long version = codeVersion;
+	bool ok = true;
+
+	CPU* shadow = lockstep ? new CPU(*this) : NULL;
+
+	for (;;){
+		if (PC >= n){
+			PC = n - 1;
+		}
+		if (limit != UINT64_MAX && instret - begin + slack > limit){
+			runInterp(limit - (instret - begin));
+			break;
+		}
+		uint32_t start = PC;
+		JitBlock block = code[start];
+
+		uint8_t first = threadedKind(program[start]);
+		if (!block && ++heat[start] >= JIT_THRESHOLD && first != T_HALT && first != T_CSR){
+			if (!compileBlock(program, start, cursor, buffer + JIT_BUFFER_SIZE, block)){
+				// buffer full: throw all compiled code away and start over
+				code.assign(n, NULL);
+				cursor = buffer;
+				compileBlock(program, start, cursor, buffer + JIT_BUFFER_SIZE, block);
+			}
+			code[start] = block;
+		}
+
+		if (block){
+			uint32_t executed = 0;
+			PC = block(regfile, this, &executed);
+			instret += executed;
+			if (PC >= n){
+				PC = n - 1;
+			}
+			if (shadow && !lockstepCheck(*this, *shadow, start, executed)){
+				ok = false;
+				break;
+			}
+		}
+		else{
+			// cold (or untranslatable) code: interpret up to and including the next branch
+			int r;
+			do {
+				r = step();
+				if (shadow && r != STEP_HALT){
+					shadow->step();
+				}
+			} while (r == STEP_NEXT && codeVersion == version);
+			if (r == STEP_HALT){
+				break;
+			}
+		}
+
+		if (codeVersion != version){ // self-modifying code: nothing compiled can be trusted
+			code.assign(n, NULL);
+			heat.assign(n, 0);
+			cursor = buffer;
+			version = codeVersion;
+		}
+	}
+
+	delete shadow;
+	munmap(buffer, JIT_BUFFER_SIZE);
+	return ok;
+}
+
+#else
+
+// not an x86-64 host: nothing to compile to, so run the fastest interpreter instead
+bool CPU::runJIT(bool lockstep, uint64_t limit)
+{
+	(void)lockstep;
+	runThreaded(limit);
+	return true;
+}
+
+#endif
@@ -0,0 +1,337 @@
+#include "Lanes.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+using namespace std;
+
+/*
+Structure-of-arrays CPU: N copies of the machine with the register file stored as x[reg][lane] and
+one PC per lane. Every round picks one PC (see run()) and takes all lanes sitting there (the mask)
+through the basic block that starts at it; the other lanes are left alone. ALU ops, branches and jumps
+are straight loops over the lanes with the mask blended in, which the compiler turns into SIMD (SSE2
+by default, AVX2/AVX-512 when built with -mavx2/-march=native). Loads and stores go lane by lane
+through a per-lane CPU that owns that copy's data memory and image.
+A lane that finishes is refilled with the next input straight away, so a sweep keeps all lanes busy
+until the inputs run out. A lane that stores into its instruction image no longer runs the shared
+program, so it is moved to its own CPU and finished there.
+*/
+
+struct SweepResult {
+	int a0, a1;
+	uint64_t instret;
+};
+
+// program[] translated once for the lanes
+struct LaneOp {
+	uint8_t kind; // ThreadedKind
+	uint8_t rd, rs1, rs2;
+	int32_t imm;
+	uint32_t taken; // branches/JAL: target PC, clamped into the program
+};
+
+template <int N>
+class LaneCPU {
+public:
+	LaneCPU(const CPU& proto, const vector<vector<int> >& inputs, vector<SweepResult>& results);
+	void run();
+
+private:
+	const CPU& proto;
+	uint32_t n;
+	vector<LaneOp> ops;
+	const vector<vector<int> >& inputs;
+	vector<SweepResult>& results;
+	size_t next;           // next input to hand out
+
+	int32_t x[32][N];      // register file, one row per register
+	uint32_t pc[N];
+	uint32_t trip[N];      // backward jumps taken so far (see run())
+	int32_t live[N];       // -1 while the lane runs an input, 0 once the inputs are used up
+	uint64_t retired[N];
+	size_t task[N];        // which input each lane is running
+	vector<CPU> lane;      // per-lane data memory and image
+
+	void refill(int l);
+	void finish(int l);
+	void evict(int l, uint32_t resume);
+};
+
+// r = m ? v : r, lane by lane
+template <int N>
+static inline void merge(int32_t* r, const int32_t* v, const int32_t* m)
+{
+	for (int l = 0; l < N; l++){
+		r[l] = (v[l] & m[l]) | (r[l] & ~m[l]);
+	}
+}
+
+template <int N>
+LaneCPU<N>::LaneCPU(const CPU& proto, const vector<vector<int> >& inputs, vector<SweepResult>& results)
+	: proto(proto), n(proto.program.size()), ops(n), inputs(inputs), results(results), next(0), lane(N, proto)
+{
+	for (uint32_t i = 0; i < n; i++){
+		const DecodedOp& d = proto.program[i];
+		LaneOp& o = ops[i];
+		o.kind = threadedKind(d);
+		o.rd = d.rd;
+		o.rs1 = d.rs1;
+		o.rs2 = d.rs2;
+		o.imm = d.imm;
+		long target = (long)i + d.imm/4;
+		o.taken = (target < 0 || target >= (long)n) ? n - 1 : (uint32_t)target;
+	}
+	for (int l = 0; l < N; l++){
+		live[l] = 0;
+	}
+	for (int l = 0; l < N; l++){
+		refill(l);
+	}
+}
+
+template <int N>
+void LaneCPU<N>::refill(int l)
+{
+	if (next >= inputs.size()){
+		live[l] = 0;
+		pc[l] = 0;
+		return;
+	}
+	// a copy that never touched memory or its image is still as good as new
+	CPU& c = lane[l];
+	if (c.memory().pagesAllocated() != 0 || proto.memory().pagesAllocated() != 0 || c.codeVersion != proto.codeVersion){
+		c = proto;
+	}
+	task[l] = next;
+	const vector<int>& in = inputs[next++];
+	for (int r = 0; r < 32; r++){
+		x[r][l] = 0;
+	}
+	for (size_t i = 0; i < in.size() && i < 8; i++){
+		x[10 + i][l] = in[i];
+	}
+	pc[l] = 0;
+	retired[l] = 0;
+	live[l] = -1;
+	// start on the oldest trip still running so the new copy isn't stuck behind everyone else
+	trip[l] = ~0u;
+	for (int k = 0; k < N; k++){
+		if (live[k] && k != l && trip[k] < trip[l]) trip[l] = trip[k];
+	}
+	if (trip[l] == ~0u){
+		trip[l] = 0;
+	}
+}
+
+template <int N>
+void LaneCPU<N>::finish(int l)
+{
+	SweepResult& r = results[task[l]];
+	r.a0 = x[10][l];
+	r.a1 = x[11][l];
+	r.instret = retired[l];
+	refill(l);
+}
+
+template <int N>
+void LaneCPU<N>::evict(int l, uint32_t resume)
+{
+	CPU& c = lane[l];
+	for (int r = 0; r < 32; r++){
+		c.regfile[r] = x[r][l];
+	}
+	c.setPC(resume);
+	c.instret = retired[l];
+	c.runThreaded();
+	SweepResult& r = results[task[l]];
+	r.a0 = c.regfile[10];
+	r.a1 = c.regfile[11];
+	r.instret = c.instret;
+	c = proto; // its image no longer matches the program the others run
+	refill(l);
+}
+
+template <int N>
+void LaneCPU<N>::run()
+{
+	for (;;){
+		// go on with the lowest (trip, PC) among the live lanes. Every backward jump starts a new trip,
+		// so lanes that went round a loop wait at the top until the ones still on the previous trip
+		// get there too, and the group re-forms at the loop head instead of drifting apart.
+		uint64_t first = ~0ull;
+		for (int l = 0; l < N; l++){
+			uint64_t key = live[l] ? ((uint64_t)trip[l] << 32 | pc[l]) : ~0ull;
+			first = key < first ? key : first;
+		}
+		if (first == ~0ull){
+			return;
+		}
+		uint32_t p = (uint32_t)first;
+		uint32_t t = first >> 32;
+		int32_t m[N];
+		for (int l = 0; l < N; l++){
+			m[l] = live[l] & -(int32_t)(pc[l] == p && trip[l] == t);
+		}
+
+		// take the group through the block at p; nothing but the registers changes until its branch
+		int32_t v[N];
+		uint32_t i = p;
+		for (;; i++){
+			const LaneOp& o = ops[i];
+			const int32_t* a = x[o.rs1];
+			const int32_t* b = x[o.rs2];
+			int32_t* r = x[o.rd];
+			int32_t imm = o.imm;
+
+			switch (o.kind){
+				case T_NOP:
+					continue;
+#define ALU(expr) for (int l = 0; l < N; l++) v[l] = (expr); merge<N>(r, v, m); continue
+#define U(a) ((uint32_t)(a))
+				case T_ADD:   ALU(U(a[l]) + U(b[l]));
+				case T_SUB:   ALU(U(a[l]) - U(b[l]));
+				case T_SLL:   ALU(U(a[l]) << (b[l] & 31));
+				case T_SLT:   ALU(a[l] < b[l]);
+				case T_SLTU:  ALU(U(a[l]) < U(b[l]));
+				case T_XOR:   ALU(a[l] ^ b[l]);
+				case T_SRL:   ALU(U(a[l]) >> (b[l] & 31));
+				case T_SRA:   ALU(a[l] >> (b[l] & 31));
+				case T_OR:    ALU(a[l] | b[l]);
+				case T_AND:   ALU(a[l] & b[l]);
+				case T_ADDI:  ALU(U(a[l]) + U(imm));
+				case T_SLTI:  ALU(a[l] < imm);
+				case T_SLTIU: ALU(U(a[l]) < U(imm));
+				case T_XORI:  ALU(a[l] ^ imm);
+				case T_ORI:   ALU(a[l] | imm);
+				case T_ANDI:  ALU(a[l] & imm);
+				case T_SLLI:  ALU(U(a[l]) << imm);
+				case T_SRLI:  ALU(U(a[l]) >> imm);
+				case T_SRAI:  ALU(a[l] >> imm);
+				case T_LUI:   ALU(imm);
+				case T_CSR:   ALU(csrWord(imm, retired[l] + (i - p))); // each lane's own instret
+#undef ALU
+				case T_LB:
+				case T_LH:
+				case T_LW:
+				case T_LBU:
+				case T_LHU:
+					for (int l = 0; l < N; l++){
+						if (!m[l]) continue;
+						uint32_t address = a[l] + imm;
+						switch (o.kind){
+							case T_LB: r[l] = lane[l].loadbyte(address); break;
+							case T_LH: r[l] = lane[l].loadhalf(address); break;
+							case T_LW: r[l] = lane[l].loadword(address); break;
+							case T_LBU: r[l] = lane[l].loadbyteunsigned(address); break;
+							default: r[l] = lane[l].loadhalfunsigned(address); break;
+						}
+					}
+					continue;
+				case T_SB:
+				case T_SH:
+				case T_SW:
+					for (int l = 0; l < N; l++){
+						if (!m[l]) continue;
+						unsigned long version = lane[l].codeVersion;
+						if (o.kind == T_SW) lane[l].storeword(a[l] + imm, b[l]);
+						else if (o.kind == T_SH) lane[l].storehalf(a[l] + imm, b[l]);
+						else lane[l].storebyte(a[l] + imm, b[l]);
+						if (lane[l].codeVersion != version){
+							m[l] = 0;
+							retired[l] += i - p + 1;
+							evict(l, i + 1);
+						}
+					}
+					continue;
+				// v = next PC of every lane, picked with the condition as a mask
+#define BRANCH(cond) for (int l = 0; l < N; l++){ int32_t t = -(int32_t)(cond); v[l] = (t & (int32_t)o.taken) | (~t & (int32_t)(i + 1)); } break
+				case T_BEQ:  BRANCH(a[l] == b[l]);
+				case T_BNE:  BRANCH(a[l] != b[l]);
+				case T_BLT:  BRANCH(a[l] < b[l]);
+				case T_BGE:  BRANCH(a[l] >= b[l]);
+				case T_BLTU: BRANCH(U(a[l]) < U(b[l]));
+				case T_BGEU: BRANCH(U(a[l]) >= U(b[l]));
+#undef BRANCH
+#undef U
+				case T_JAL:
+				case T_J:
+					for (int l = 0; l < N; l++) v[l] = o.taken;
+					if (o.kind == T_JAL){
+						int32_t link[N];
+						for (int l = 0; l < N; l++) link[l] = 4*i + 4;
+						merge<N>(r, link, m);
+					}
+					break;
+				case T_JALR:
+				case T_JR:
+					for (int l = 0; l < N; l++){
+						uint32_t target = (((uint32_t)a[l] + (uint32_t)imm) & ~1u) / 4;
+						v[l] = (int32_t)(target < n ? target : n - 1);
+					}
+					if (o.kind == T_JALR){ // after the targets: rd may be rs1
+						int32_t link[N];
+						for (int l = 0; l < N; l++) link[l] = 4*i + 4;
+						merge<N>(r, link, m);
+					}
+					break;
+				default: // T_HALT
+					for (int l = 0; l < N; l++){
+						if (m[l]){
+							retired[l] += i - p;
+							finish(l);
+						}
+					}
+					break;
+			}
+			break;
+		}
+		if (ops[i].kind == T_HALT){
+			continue;
+		}
+
+		// the block ended in a branch: v holds every lane's next PC
+		merge<N>((int32_t*)pc, v, m);
+		for (int l = 0; l < N; l++){
+			trip[l] += m[l] & (pc[l] <= i);
+			retired[l] += m[l] & (i - p + 1);
+		}
+	}
+}
+
+bool runSweep(const CPU& proto, const string& inputs, unsigned lanes, ostream& out)
+{
+	ifstream in(inputs.c_str());
+	if (!in || (lanes != 8 && lanes != 16)){
+		return false;
+	}
+	vector<vector<int> > sets;
+	string line;
+	while (getline(in, line)){
+		size_t hash = line.find('#');
+		if (hash != string::npos){
+			line.erase(hash);
+		}
+		istringstream fields(line);
+		vector<int> set;
+		int value;
+		while (fields >> value){
+			set.push_back(value);
+		}
+		if (set.empty()){ // blank lines and comments
+			continue;
+		}
+		sets.push_back(set);
+	}
+
+	vector<SweepResult> results(sets.size());
+	if (lanes == 16){
+		LaneCPU<16>(proto, sets, results).run();
+	}
+	else{
+		LaneCPU<8>(proto, sets, results).run();
+	}
+	for (size_t i = 0; i < results.size(); i++){
+		out << "(" << results[i].a0 << "," << results[i].a1 << ")\n";
+	}
+	return true;
+}
@@ -0,0 +1,17 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include "CPU.h"
+
+#include <string>
+using namespace std;
+
+/*
+Parameter sweeps: run the same program once per input line, 8 or 16 copies at a time in lockstep.
+Each input line holds up to eight integers that go into a0..a7 before the run; everything else starts
+from proto (registers zero, memory and image as loaded). Results are printed one "(a0,a1)" per input,
+in input order. Returns false if the inputs file can't be opened or lanes isn't 8 or 16.
+*/
+bool runSweep(const CPU& proto, const string& inputs, unsigned lanes, ostream& out);
+
+#endif /* LANES_H */
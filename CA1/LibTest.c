@@ -0,0 +1,94 @@
+/*
+Checks libcpusim from C: every bundled program on every engine, run to halt in one call and again
+in slices of a few instructions after a reset, must leave the (a0,a1) its listing expects, and a
+memory write must read back. Prints PASS/FAIL per program and engine; exits 1 on any failure.
+Build and run with make test-lib.
+*/
+#include "libcpusim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char* tests[] = { "r", "swr", "jswr", "test", "csr" };
+static const char* engines[] = { "interp", "threaded", "blocks", "jit" };
+
+/* the "# a0 = " and "# a1 = " lines of a listing */
+static int expected(const char* test, int32_t* a0, int32_t* a1)
+{
+	char path[64], line[256];
+	int found = 0;
+	snprintf(path, sizeof path, "25%s.txt", test);
+	FILE* f = fopen(path, "r");
+	if (!f) return 0;
+	while (fgets(line, sizeof line, f)){
+		found += sscanf(line, "# a0 = %d", a0) + sscanf(line, "# a1 = %d", a1);
+	}
+	fclose(f);
+	return found == 2;
+}
+
+static int check(cpusim* sim, const char* test, const char* engine, const char* how, int32_t a0, int32_t a1)
+{
+	int32_t got0 = cpusim_get_reg(sim, 10), got1 = cpusim_get_reg(sim, 11);
+	if (!cpusim_halted(sim) || got0 != a0 || got1 != a1){
+		printf("FAIL %s %s %s: got (%d,%d), expected (%d,%d)\n", test, engine, how, got0, got1, a0, a1);
+		return 1;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	int fail = 0;
+	for (size_t t = 0; t < sizeof tests / sizeof *tests; t++){
+		char path[64];
+		int32_t a0, a1;
+		snprintf(path, sizeof path, "25instMem-%s.txt", tests[t]);
+		if (!expected(tests[t], &a0, &a1)){
+			printf("FAIL %s: can't read its listing\n", tests[t]);
+			fail = 1;
+			continue;
+		}
+		cpusim* sim = cpusim_new();
+		if (cpusim_load_file(sim, path) != 0){
+			printf("FAIL %s: can't load %s\n", tests[t], path);
+			fail = 1;
+			cpusim_free(sim);
+			continue;
+		}
+		for (size_t e = 0; e < sizeof engines / sizeof *engines; e++){
+			int bad = 0;
+			cpusim_set_engine(sim, engines[e]);
+
+			cpusim_reset(sim);
+			uint64_t total = cpusim_run(sim, CPUSIM_UNLIMITED);
+			bad |= check(sim, tests[t], engines[e], "whole", a0, a1);
+			bad |= cpusim_instret(sim) != total;
+
+			cpusim_reset(sim);
+			uint64_t sliced = 0, ran;
+			while ((ran = cpusim_run(sim, 7)) != 0){
+				sliced += ran;
+			}
+			bad |= check(sim, tests[t], engines[e], "sliced", a0, a1);
+			if (sliced != total){
+				printf("FAIL %s %s: %llu instructions in slices, %llu whole\n", tests[t], engines[e],
+					(unsigned long long)sliced, (unsigned long long)total);
+				bad = 1;
+			}
+
+			uint32_t in = 0xC0FFEE00u + (uint32_t)e, out = 0;
+			cpusim_write_mem(sim, 0x10000, &in, sizeof in);
+			cpusim_read_mem(sim, 0x10000, &out, sizeof out);
+			if (out != in){
+				printf("FAIL %s %s: memory round trip gave %08x\n", tests[t], engines[e], out);
+				bad = 1;
+			}
+
+			if (!bad) printf("PASS %s %s\n", tests[t], engines[e]);
+			fail |= bad;
+		}
+		cpusim_free(sim);
+	}
+	return fail;
+}
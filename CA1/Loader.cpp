@@ -0,0 +1,137 @@
+#include "Loader.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+using namespace std;
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define HAVE_MMAP 1
+#endif
+
+static int hexValue(unsigned char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static bool isSpace(unsigned char c)
+{
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// hex text: each token is one byte; false (naming the file and line) at the first token that isn't
+static bool parseText(const char* path, const unsigned char* p, size_t size, vector<uint32_t>& words)
+{
+	words.clear();
+	words.reserve(size / 12 + 1); // "xx\n" per byte
+	uint32_t word = 0;
+	int nbytes = 0;
+	size_t i = 0, line = 1;
+	while (i < size){
+		if (isSpace(p[i])){
+			line += (p[i] == '\n');
+			i++;
+			continue;
+		}
+		uint32_t value = 0;
+		int digit;
+		size_t tokenStart = i;
+		while (i < size && (digit = hexValue(p[i])) >= 0){
+			value = (value << 4) | digit;
+			i++;
+		}
+		if (i == tokenStart || (i < size && !isSpace(p[i])) || i - tokenStart > 2){
+			while (i < size && !isSpace(p[i])) i++;
+			cerr << path << ":" << line << ": \"" << string((const char*)p + tokenStart, i - tokenStart)
+				<< "\" is not a hex byte (raw images must end in .bin)\n";
+			words.clear();
+			return false;
+		}
+		word |= value << (8 * nbytes);
+		if (++nbytes == 4){
+			words.push_back(word);
+			word = 0;
+			nbytes = 0;
+		}
+	}
+	if (nbytes != 0){ // trailing partial instruction, upper bytes read as 0
+		words.push_back(word);
+	}
+	return true;
+}
+
+// raw little-endian words (a trailing partial word is zero padded)
+static void parseBinary(const unsigned char* p, size_t size, vector<uint32_t>& words)
+{
+	words.assign((size + 3) / 4, 0);
+	for (size_t i = 0; i < size; i++){
+		words[i / 4] |= (uint32_t)p[i] << (8 * (i % 4));
+	}
+}
+
+static bool endsWith(const char* s, const char* suffix)
+{
+	size_t n = strlen(s), m = strlen(suffix);
+	return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+bool loadImage(const char* path, vector<uint32_t>& words)
+{
+	bool binary = endsWith(path, ".bin");
+	words.clear();
+
+#ifdef HAVE_MMAP
+	int fd = open(path, O_RDONLY);
+	if (fd < 0){
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0){
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	if (size == 0){
+		close(fd);
+		return true;
+	}
+	void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED){
+		return false;
+	}
+	const unsigned char* p = (const unsigned char*)map;
+	bool ok = true;
+	if (binary){
+		parseBinary(p, size, words);
+	}
+	else{
+		ok = parseText(path, p, size, words);
+	}
+	munmap(map, size);
+	return ok;
+#else
+	ifstream in(path, ios::binary);
+	if (!in.is_open()){
+		return false;
+	}
+	vector<unsigned char> bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	const unsigned char* p = bytes.empty() ? NULL : &bytes[0];
+	if (binary){
+		parseBinary(p, bytes.size(), words);
+	}
+	else if (!parseText(path, p, bytes.size(), words)){
+		return false;
+	}
+#endif
+	return true;
+}
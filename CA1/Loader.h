@@ -0,0 +1,17 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+/*
+Reads a program image into 32-bit instruction words.
+Text images are the assignment format: whitespace separated hex bytes (one per line), four bytes per
+instruction in little-endian order. Files ending in .bin are raw little-endian words. Returns false
+if the file can't be opened, or if a text image has something other than a hex byte in it (reported
+on stderr with its line).
+*/
+bool loadImage(const char* path, vector<uint32_t>& words);
+
+#endif /* LOADER_H */
@@ -0,0 +1,109 @@
+#include "Memory.h"
+
+#include <cstring>
+
+Memory::Memory() : numPages(0), owner(this), lastBase(NO_PAGE), lastPage(NULL)
+{
+	for (uint32_t d = 0; d < DIR_SIZE; d++){
+		dir[d] = NULL;
+	}
+}
+
+Memory::Memory(const Memory& other) : numPages(0), owner(this), lastBase(NO_PAGE), lastPage(NULL)
+{
+	for (uint32_t d = 0; d < DIR_SIZE; d++){
+		dir[d] = NULL;
+	}
+	copyFrom(other);
+}
+
+Memory& Memory::operator=(const Memory& other)
+{
+	if (this != &other){
+		clear();
+		owner = this; // a copy always gets pages of its own
+		copyFrom(other);
+	}
+	return *this;
+}
+
+Memory::~Memory()
+{
+	clear();
+}
+
+void Memory::copyFrom(const Memory& other)
+{
+	Memory* self = this;
+	other.forEachPage([self](uint32_t base, const uint8_t* data) {
+		memcpy(self->page(base), data, PAGE_SIZE);
+	});
+}
+
+void Memory::share(Memory& other)
+{
+	clear();
+	owner = other.owner;
+}
+
+uint8_t* Memory::page(uint32_t address)
+{
+	if (owner != this){
+		return owner->page(address);
+	}
+	uint32_t d = address >> (DIR_BITS + PAGE_BITS);
+	uint32_t p = (address >> PAGE_BITS) & (DIR_SIZE - 1);
+	// whoever loses the race to fill a slot throws its copy away and takes the winner's
+	PageSlot* table = dir[d].load(std::memory_order_acquire);
+	if (!table){
+		PageSlot* fresh = new PageSlot[DIR_SIZE]();
+		if (dir[d].compare_exchange_strong(table, fresh, std::memory_order_acq_rel)) table = fresh;
+		else delete[] fresh;
+	}
+	uint8_t* data = table[p].load(std::memory_order_acquire);
+	if (!data){
+		uint8_t* fresh = new uint8_t[PAGE_SIZE](); // untouched memory reads as zero
+		if (table[p].compare_exchange_strong(data, fresh, std::memory_order_acq_rel)){
+			data = fresh;
+			numPages++;
+		}
+		else{
+			delete[] fresh;
+		}
+	}
+	return data;
+}
+
+const uint8_t* Memory::findPage(uint32_t address) const
+{
+	const PageSlot* table = owner->dir[address >> (DIR_BITS + PAGE_BITS)].load(std::memory_order_acquire);
+	return table ? table[(address >> PAGE_BITS) & (DIR_SIZE - 1)].load(std::memory_order_acquire) : NULL;
+}
+
+void Memory::zero()
+{
+	if (owner != this){
+		return;
+	}
+	forEachPage([](uint32_t base, uint8_t* data) {
+		memset(data, 0, PAGE_SIZE);
+	});
+}
+
+void Memory::clear()
+{
+	forget();
+	if (owner != this){
+		return;
+	}
+	for (uint32_t d = 0; d < DIR_SIZE; d++){
+		PageSlot* table = dir[d].load();
+		if (!table) continue;
+		for (uint32_t p = 0; p < DIR_SIZE; p++){
+			delete[] table[p].load();
+		}
+		delete[] table;
+		dir[d] = NULL;
+	}
+	numPages = 0;
+}
@@ -0,0 +1,100 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+/*
+Sparse paged memory covering the whole 32-bit address space.
+A two-level table (1024 directories x 1024 pages of 4 KB) is filled in lazily on first touch, so only
+what a program actually uses is allocated. The last page handed out is cached: hit() compares the
+address against it together with the low bits an aligned access must have clear, so an aligned
+access to the same page costs a single compare.
+Several Memory objects can share one set of pages (share()): each keeps its own last-page cache, and
+pages are allocated with a compare-and-swap so harts on different threads can touch new pages at once.
+*/
+class Memory {
+public:
+	static const uint32_t PAGE_BITS = 12;
+	static const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+	static const uint32_t PAGE_MASK = ~(PAGE_SIZE - 1);
+	static const uint32_t DIR_BITS = 10;
+	static const uint32_t DIR_SIZE = 1u << DIR_BITS;
+
+	Memory();
+	Memory(const Memory& other);
+	Memory& operator=(const Memory& other);
+	~Memory();
+
+	// fast path: alignMask is 3 for words, 1 for halves, 0 for bytes
+	bool hit(uint32_t address, uint32_t alignMask) const { return (address & (PAGE_MASK | alignMask)) == lastBase; }
+	uint8_t* lastPtr(uint32_t address) const { return lastPage + (address & ~PAGE_MASK); }
+
+	uint8_t* page(uint32_t address);               // start of the page holding address, allocated on first touch
+	const uint8_t* findPage(uint32_t address) const; // same, but NULL instead of allocating
+	void cache(uint32_t address, uint8_t* page) { lastBase = address & PAGE_MASK; lastPage = page; }
+	void forget() { lastBase = NO_PAGE; lastPage = NULL; }
+
+	void share(Memory& other); // drop our pages and use other's from now on
+	bool shared() const { return owner != this; }
+
+	size_t pagesAllocated() const { return owner->numPages; }
+	void clear(); // drop every page (just forget them if they're shared from another Memory)
+	void zero();  // zero every page in place, keeping it allocated (nothing if the pages are shared)
+
+	// calls f(base address, page data) for every allocated page in address order
+	template <class F> void forEachPage(F f) const
+	{
+		for (uint32_t d = 0; d < DIR_SIZE; d++){
+			const PageSlot* table = owner->dir[d].load(std::memory_order_acquire);
+			if (!table) continue;
+			for (uint32_t p = 0; p < DIR_SIZE; p++){
+				uint8_t* data = table[p].load(std::memory_order_acquire);
+				if (data) f((d << (DIR_BITS + PAGE_BITS)) | (p << PAGE_BITS), data);
+			}
+		}
+	}
+
+private:
+	static const uint32_t NO_PAGE = 0xFFFFFFFF; // never equal to address & (PAGE_MASK | alignMask)
+
+	typedef std::atomic<uint8_t*> PageSlot;
+
+	std::atomic<PageSlot*> dir[DIR_SIZE];
+	std::atomic<size_t> numPages;
+	Memory* owner; // whose dir the pages are in: this, or the Memory we share()
+	uint32_t lastBase;
+	uint8_t* lastPage;
+
+	void copyFrom(const Memory& other);
+};
+
+// little-endian helpers for page data
+inline uint32_t readLE32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+inline void writeLE32(uint8_t* p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+inline uint32_t readLE16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+inline void writeLE16(uint8_t* p, uint32_t v) { p[0] = v; p[1] = v >> 8; }
+
+// aligned words in data memory: a single access, so a hart never sees half of another hart's store.
+// Stores release and loads acquire, so data stored before a flag is there for whoever sees the flag
+// (on x86-64 both are plain moves).
+inline uint32_t loadWord(const uint8_t* p)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return __atomic_load_n((const uint32_t*)p, __ATOMIC_ACQUIRE);
+#else
+	return readLE32(p);
+#endif
+}
+
+inline void storeWord(uint8_t* p, uint32_t v)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	__atomic_store_n((uint32_t*)p, v, __ATOMIC_RELEASE);
+#else
+	writeLE32(p, v);
+#endif
+}
+
+#endif /* MEMORY_H */
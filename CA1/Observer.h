@@ -0,0 +1,151 @@
+#ifndef OBSERVER_H
+#define OBSERVER_H
+
+#include "CPU.h"
+
+/*
+Hooks into the reference engine. CPU::stepObserved<O>() is the one definition of what an instruction
+does, and it tells an observer of type O what happened as it goes:
+	onExec(pc, op)                      every instruction that executes (not the halt), before it runs
+	onLoad(pc, address, bytes)          every load, with the effective address
+	onStore(pc, address, bytes)         every store
+	onBranch(pc, op, taken, next)       branches, JAL and JALR (jumps are always taken); next is the
+	                                    PC that executes next
+	readCycle(cpu)                      what a cycle or time CSR read returns; a timing model gives
+	                                    its own cycle count, everything else one cycle per instruction
+Observers derive from Observer and hide the hooks they care about. The calls are resolved at compile
+time, so the hooks an observer doesn't define are empty inline functions and cost nothing; with the
+plain Observer (what step() and runInterp() use) the loop is the same as with no hooks at all.
+*/
+struct Observer {
+	void onExec(uint32_t pc, const DecodedOp& op) {}
+	void onLoad(uint32_t pc, uint32_t address, int bytes) {}
+	void onStore(uint32_t pc, uint32_t address, int bytes) {}
+	void onBranch(uint32_t pc, const DecodedOp& op, bool taken, uint32_t next) {}
+	uint64_t readCycle(const CPU& cpu) { return cpu.instret; }
+};
+
+template <class O>
+inline int CPU::stepObserved(O& obs)
+{
+	if (PC >= program.size()){ // ran off the end of instruction memory
+		return STEP_HALT;
+	}
+	const DecodedOp& op = program[PC];
+	if (op.opclass == OP_HALT){
+		return STEP_HALT;
+	}
+	obs.onExec(PC, op);
+
+	int resToWriteBack;
+	uint32_t address = regfile[op.rs1] + op.imm; // loads/stores
+	switch (op.opclass){
+		case OP_RTYPE:
+			alu.executeALU(op.aluop, regfile[op.rs1], regfile[op.rs2]);
+			resToWriteBack = alu.alu_res;
+			break;
+		case OP_ITYPE:
+			alu.executeALU(op.aluop, regfile[op.rs1], op.imm);
+			resToWriteBack = alu.alu_res;
+			break;
+		case OP_LUI:
+		case OP_AUIPC: // predecode already added the PC
+			resToWriteBack = op.imm;
+			break;
+		case OP_LB:
+			obs.onLoad(PC, address, 1);
+			resToWriteBack = loadbyte(address);
+			break;
+		case OP_LH:
+			obs.onLoad(PC, address, 2);
+			resToWriteBack = loadhalf(address);
+			break;
+		case OP_LW:
+			obs.onLoad(PC, address, 4);
+			resToWriteBack = loadword(address);
+			break;
+		case OP_LBU:
+			obs.onLoad(PC, address, 1);
+			resToWriteBack = loadbyteunsigned(address);
+			break;
+		case OP_LHU:
+			obs.onLoad(PC, address, 2);
+			resToWriteBack = loadhalfunsigned(address);
+			break;
+		case OP_SB:
+		case OP_SH:
+		case OP_SW: {
+			int bytes = (op.opclass == OP_SW) ? 4 : (op.opclass == OP_SH) ? 2 : 1;
+			obs.onStore(PC, address, bytes);
+			if (bytes == 4) storeword(address, regfile[op.rs2]);
+			else if (bytes == 2) storehalf(address, regfile[op.rs2]);
+			else storebyte(address, regfile[op.rs2]);
+			PC++;
+			instret++;
+			return STEP_NEXT;
+		}
+		case OP_BEQ:
+		case OP_BNE:
+		case OP_BLT:
+		case OP_BGE:
+		case OP_BLTU:
+		case OP_BGEU: {
+			unsigned long pc = PC;
+			bool taken = branchTaken(op.opclass, regfile[op.rs1], regfile[op.rs2]);
+			if (!taken){
+				PC++;
+			}
+			else{ // gotta branch to label which is immediate
+				PC += op.imm/4;
+			}
+			instret++;
+			obs.onBranch(pc, op, taken, PC);
+			return STEP_BRANCH;
+		}
+		case OP_JAL: {
+			unsigned long pc = PC;
+			if (op.rd != 0){
+				regfile[op.rd] = 4*PC + 4;
+			}
+			PC += op.imm/4;
+			instret++;
+			obs.onBranch(pc, op, true, PC);
+			return STEP_BRANCH;
+		}
+		case OP_JALR: {
+			unsigned long pc = PC;
+			// jump to reg[rs1] + offset [31:1], 1'b0 (computed before rd is overwritten)
+			uint32_t target = (regfile[op.rs1] + op.imm) & ~1;
+			// write address to jump back to to reg rd
+			if (op.rd != 0){ // only if not x0
+				regfile[op.rd] = 4*PC + 4;
+			}
+			PC = target/4;
+			instret++;
+			obs.onBranch(pc, op, true, PC);
+			return STEP_BRANCH;
+		}
+		case OP_CSR: // instret counts the instructions before this one
+			resToWriteBack = csrWord(op.imm, isInstretCSR(op.imm) ? instret : obs.readCycle(*this));
+			break;
+		default: // OP_HALT
+			return STEP_HALT;
+	}
+
+	// write back (can't write to x0)
+	if (op.rd != 0){
+		regfile[op.rd] = resToWriteBack;
+	}
+	PC++;
+	instret++;
+	return STEP_NEXT;
+}
+
+template <class O>
+void CPU::runObserved(O& obs)
+{
+	while (stepObserved(obs) != STEP_HALT){
+	}
+}
+
+#endif /* OBSERVER_H */
@@ -0,0 +1,197 @@
+#include "Pipeline.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+using namespace std;
+
+static const char* const stageNames[NUM_STAGES] = { "IF", "ID", "EX", "MEM", "WB" };
+
+PipelineConfig::PipelineConfig() : forwarding(true), branchStage(STAGE_EX), jalrStage(STAGE_EX)
+{
+	for (int s = 0; s < NUM_STAGES; s++){
+		latency[s] = 1;
+	}
+}
+
+bool parseLatencies(const string& text, PipelineConfig& config)
+{
+	istringstream in(text);
+	unsigned lat[NUM_STAGES];
+	for (int s = 0; s < NUM_STAGES; s++){
+		char comma;
+		if (!(in >> lat[s]) || lat[s] == 0 || (s + 1 < NUM_STAGES && !(in >> comma && comma == ','))){
+			return false;
+		}
+	}
+	char extra;
+	if (in >> extra){
+		return false;
+	}
+	for (int s = 0; s < NUM_STAGES; s++){
+		config.latency[s] = lat[s];
+	}
+	return true;
+}
+
+bool parseStage(const string& text, PipeStage& stage)
+{
+	if (text == "ID") stage = STAGE_ID;
+	else if (text == "EX") stage = STAGE_EX;
+	else if (text == "MEM") stage = STAGE_MEM;
+	else return false;
+	return true;
+}
+
+Pipeline::Pipeline(const PipelineConfig& config)
+	: config(config), redirect(0), redirectCause(STALL_BRANCH), done(0), count(0), fillCycles(0)
+{
+	for (int s = 0; s < NUM_STAGES; s++){
+		prev[s] = cur[s] = 0;
+	}
+	for (int r = 0; r < 32; r++){
+		ready[r] = 0;
+		fromLoad[r] = false;
+	}
+	for (int c = 0; c < NUM_CAUSES; c++){
+		stall[c] = 0;
+	}
+}
+
+void Pipeline::onExec(uint32_t pc, const DecodedOp& op)
+{
+	const unsigned* lat = config.latency;
+	bool fwd = config.forwarding;
+	bool load = isLoad(op.opclass);
+	bool store = isStore(op.opclass);
+	bool branch = isBranch(op.opclass);
+
+	// which registers are read, and by which stage (decode leaves unused fields at x0, which never waits)
+	int src[2] = { -1, -1 };
+	PipeStage need[2] = { STAGE_EX, STAGE_EX };
+	src[0] = op.rs1;
+	if (op.opclass == OP_RTYPE || store || branch){
+		src[1] = op.rs2;
+	}
+	if (store){
+		need[1] = STAGE_MEM; // the data only has to be there for the write
+	}
+	if (branch && config.branchStage == STAGE_ID){
+		need[0] = need[1] = STAGE_ID;
+	}
+	if (op.opclass == OP_JALR && config.jalrStage == STAGE_ID){
+		need[0] = STAGE_ID;
+	}
+	if (!fwd){ // everything comes out of the register file
+		need[0] = need[1] = STAGE_ID;
+	}
+
+	uint64_t e[NUM_STAGES];
+	uint64_t natural = count ? prev[STAGE_ID] : 0; // IF is free once the previous one moved to ID
+	e[STAGE_IF] = natural > redirect ? natural : redirect;
+	uint64_t branchStall = e[STAGE_IF] - natural;
+	int branchCause = redirectCause;
+	redirect = 0;
+
+	uint64_t loadStall = 0, rawStall = 0;
+	for (int s = STAGE_ID; s < NUM_STAGES; s++){
+		uint64_t t = e[s - 1] + lat[s - 1];
+		// the stage is busy until the previous instruction has moved on
+		uint64_t freed = (s + 1 < NUM_STAGES) ? prev[s + 1] : prev[STAGE_WB] + lat[STAGE_WB];
+		if (count && freed > t){
+			t = freed;
+		}
+		for (int k = 0; k < 2; k++){
+			if (src[k] > 0 && need[k] == s && ready[src[k]] > t){
+				(fromLoad[src[k]] ? loadStall : rawStall) += ready[src[k]] - t;
+				t = ready[src[k]];
+			}
+		}
+		e[s] = t;
+	}
+	uint64_t finished = e[STAGE_WB] + lat[STAGE_WB];
+
+	if (count == 0){
+		fillCycles = finished - 1;
+	}
+	else{
+		// anything past one cycle after the previous instruction is a stall; charge it in flow order
+		uint64_t delta = finished - done - 1;
+		uint64_t b = branchStall < delta ? branchStall : delta;
+		stall[branchCause] += b;
+		delta -= b;
+		uint64_t l = loadStall < delta ? loadStall : delta;
+		stall[STALL_LOAD_USE] += l;
+		delta -= l;
+		uint64_t r = rawStall < delta ? rawStall : delta;
+		stall[STALL_RAW] += r;
+		delta -= r;
+		stall[STALL_STRUCTURAL] += delta;
+	}
+	done = finished;
+
+	bool writes = op.rd != 0; // stores and branches have no rd
+	if (writes){
+		if (!fwd) ready[op.rd] = e[STAGE_WB];
+		else if (load) ready[op.rd] = e[STAGE_MEM] + lat[STAGE_MEM];
+		else ready[op.rd] = e[STAGE_EX] + lat[STAGE_EX];
+		fromLoad[op.rd] = load;
+	}
+	for (int s = 0; s < NUM_STAGES; s++){
+		prev[s] = cur[s] = e[s];
+	}
+	count++;
+}
+
+void Pipeline::onBranch(uint32_t pc, const DecodedOp& op, bool taken, uint32_t next)
+{
+	if (!taken){ // fall-through is what was fetched anyway
+		return;
+	}
+	PipeStage s = isBranch(op.opclass) ? config.branchStage : (op.opclass == OP_JAL) ? STAGE_ID : config.jalrStage;
+	redirect = cur[s] + config.latency[s];
+	redirectCause = isBranch(op.opclass) ? STALL_BRANCH : STALL_JUMP;
+}
+
+void Pipeline::writeReport(ostream& out) const
+{
+	out << "pipeline IF/ID/EX/MEM/WB latencies";
+	for (int s = 0; s < NUM_STAGES; s++){
+		out << (s ? "/" : " ") << config.latency[s];
+	}
+	out << ", forwarding " << (config.forwarding ? "on" : "off")
+		<< ", branches resolved in " << stageNames[config.branchStage] << " (predicted not taken)"
+		<< ", JALR resolved in " << stageNames[config.jalrStage] << "\n";
+	out << fixed << setprecision(3);
+	out << "instructions " << count << "\n";
+	out << "cycles       " << done << "\n";
+	out << "CPI          " << (count ? (double)done / count : 0.0) << "\n";
+
+	static const char* const causeNames[NUM_CAUSES] = { "load-use", "RAW (no forwarding)", "branch taken", "JAL/JALR", "structural" };
+	uint64_t total = 0;
+	for (int c = 0; c < NUM_CAUSES; c++){
+		total += stall[c];
+	}
+	out << setprecision(2);
+	out << "stall cycles " << total << "\n";
+	for (int c = 0; c < NUM_CAUSES; c++){
+		out << "  " << left << setw(20) << causeNames[c] << right << setw(12) << stall[c]
+			<< setw(8) << (done ? 100.0 * stall[c] / done : 0.0) << "% of cycles\n";
+	}
+	out << "  " << left << setw(20) << "pipeline fill" << right << setw(12) << fillCycles << "\n";
+}
+
+bool runPipeline(CPU& cpu, const PipelineConfig& config, const string& reportPath)
+{
+	Pipeline pipe(config);
+	cpu.runObserved(pipe);
+
+	ofstream out(reportPath.c_str());
+	if (!out){
+		cerr << "can't write pipeline report " << reportPath << "\n";
+		return false;
+	}
+	pipe.writeReport(out);
+	return true;
+}
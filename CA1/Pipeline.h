@@ -0,0 +1,65 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "Observer.h"
+
+#include <string>
+using namespace std;
+
+enum PipeStage { STAGE_IF = 0, STAGE_ID, STAGE_EX, STAGE_MEM, STAGE_WB, NUM_STAGES };
+
+struct PipelineConfig {
+	unsigned latency[NUM_STAGES]; // cycles each stage takes
+	bool forwarding;              // EX/MEM results bypass to EX (and to MEM for store data)
+	PipeStage branchStage;        // where conditional branches are resolved (predicted not taken until then)
+	PipeStage jalrStage;          // where JALR's target is known (JAL's is always known in ID)
+	PipelineConfig();
+};
+
+// parse "1,1,1,3,1" into the stage latencies; false if it isn't five positive numbers
+bool parseLatencies(const string& text, PipelineConfig& config);
+// "ID", "EX" or "MEM"
+bool parseStage(const string& text, PipeStage& stage);
+
+/*
+Timing model of an in-order IF/ID/EX/MEM/WB pipeline, driven by the reference engine.
+For every instruction it works out when it enters each stage: a stage holds one instruction at a time,
+operands have to be ready by the stage that needs them (EX, or MEM for store data, or the resolving
+stage for branches; ID for everything without forwarding), and a taken branch or any jump holds the next
+fetch until it is resolved. Whatever delays an instruction beyond one cycle after the previous one
+is charged to the branch, the data hazard or the stage occupancy (structural), in that order.
+*/
+class Pipeline : public Observer {
+public:
+	Pipeline(const PipelineConfig& config);
+
+	void onExec(uint32_t pc, const DecodedOp& op);
+	void onBranch(uint32_t pc, const DecodedOp& op, bool taken, uint32_t next);
+	uint64_t readCycle(const CPU& cpu) const { return cur[STAGE_EX]; } // the reading instruction's EX cycle
+
+	enum StallCause { STALL_LOAD_USE = 0, STALL_RAW, STALL_BRANCH, STALL_JUMP, STALL_STRUCTURAL, NUM_CAUSES };
+
+	uint64_t cycles() const { return done; } // cycle the last instruction leaves WB
+	uint64_t instructions() const { return count; }
+	uint64_t stalls(int cause) const { return stall[cause]; }
+	uint64_t fill() const { return fillCycles; }
+	void writeReport(ostream& out) const;
+
+private:
+	PipelineConfig config;
+	uint64_t prev[NUM_STAGES];  // when the previous instruction entered each stage
+	uint64_t cur[NUM_STAGES];   // same for the one just executed (onBranch needs it)
+	uint64_t ready[32];         // first cycle each register's value can be used by the stage that needs it
+	bool fromLoad[32];          // that value comes from a load
+	uint64_t redirect;          // earliest fetch for the next instruction after a taken branch
+	int redirectCause;
+	uint64_t done;
+	uint64_t count;
+	uint64_t fillCycles;
+	uint64_t stall[NUM_CAUSES];
+};
+
+// run cpu to halt on the reference engine through the pipeline model; report to the given file
+bool runPipeline(CPU& cpu, const PipelineConfig& config, const string& reportPath);
+
+#endif /* PIPELINE_H */
@@ -0,0 +1,249 @@
+#include "Profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+using namespace std;
+
+static const char* const kindNames[T_NUMKINDS] = {
+	"halt", "nop",
+	"add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and",
+	"addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai",
+	"lui",
+	"lb", "lh", "lw", "lbu", "lhu",
+	"sb", "sh", "sw",
+	"beq", "bne", "blt", "bge", "bltu", "bgeu",
+	"jal", "j", "jalr", "jr",
+	"csr"
+};
+
+Profiler::Profiler(const CPU& cpu)
+	: execs(cpu.program.size(), 0), taken_(cpu.program.size(), 0), loads(cpu.program.size(), 0), stores(cpu.program.size(), 0)
+{
+	for (int k = 0; k < T_NUMKINDS; k++){
+		kinds[k] = 0;
+	}
+}
+
+void Profiler::writeReport(ostream& out, const CPU& cpu, size_t top) const
+{
+	uint64_t total = 0, totalLoads = 0, totalStores = 0, branches = 0, branchesTaken = 0;
+	for (size_t pc = 0; pc < execs.size(); pc++){
+		total += execs[pc];
+		totalLoads += loads[pc];
+		totalStores += stores[pc];
+		if (isBranch(cpu.program[pc].opclass)){
+			branches += execs[pc];
+			branchesTaken += taken_[pc];
+		}
+	}
+	out << fixed << setprecision(2);
+	out << "instructions " << total << ", loads " << totalLoads << ", stores " << totalStores
+		<< ", branches " << branches << " (" << branchesTaken << " taken, " << branches - branchesTaken << " not taken)\n\n";
+
+	// kinds, most frequent first
+	vector<int> order;
+	for (int k = 0; k < T_NUMKINDS; k++){
+		if (kinds[k]) order.push_back(k);
+	}
+	sort(order.begin(), order.end(), [this](int a, int b) { return kinds[a] > kinds[b]; });
+	out << "kind        count        %\n";
+	for (size_t i = 0; i < order.size(); i++){
+		out << left << setw(8) << kindNames[order[i]] << right << setw(12) << kinds[order[i]]
+			<< setw(9) << (total ? 100.0 * kinds[order[i]] / total : 0.0) << "\n";
+	}
+
+	// hot PCs
+	vector<uint32_t> pcs;
+	for (uint32_t pc = 0; pc < execs.size(); pc++){
+		if (execs[pc]) pcs.push_back(pc);
+	}
+	sort(pcs.begin(), pcs.end(), [this](uint32_t a, uint32_t b) { return execs[a] != execs[b] ? execs[a] > execs[b] : a < b; });
+	if (top && pcs.size() > top){
+		pcs.resize(top);
+	}
+	out << "\n     pc   address      word  kind         count        %   cumul%  taken%\n";
+	uint64_t cumul = 0;
+	for (size_t i = 0; i < pcs.size(); i++){
+		uint32_t pc = pcs[i];
+		cumul += execs[pc];
+		out << setw(7) << pc << "  0x" << hex << setfill('0') << setw(6) << 4*pc << "  " << setw(8)
+			<< (pc < cpu.image.size() ? cpu.image[pc] : 0) << dec << setfill(' ') << "  " << left << setw(6)
+			<< kindNames[threadedKind(cpu.program[pc])] << right << setw(12) << execs[pc]
+			<< setw(9) << 100.0 * execs[pc] / total << setw(9) << 100.0 * cumul / total;
+		if (isBranch(cpu.program[pc].opclass)){
+			out << setw(8) << 100.0 * taken_[pc] / execs[pc];
+		}
+		out << "\n";
+	}
+}
+
+void Profiler::writeDump(ostream& out, const CPU& cpu) const
+{
+	out << "pc,address,word,kind,count,taken,not_taken,loads,stores\n";
+	for (uint32_t pc = 0; pc < execs.size(); pc++){
+		if (!execs[pc]) continue;
+		bool branch = isBranch(cpu.program[pc].opclass);
+		out << pc << "," << 4*pc << ",0x" << hex << (pc < cpu.image.size() ? cpu.image[pc] : 0) << dec << ","
+			<< kindNames[threadedKind(cpu.program[pc])] << "," << execs[pc] << ","
+			<< (branch ? taken_[pc] : 0) << "," << (branch ? execs[pc] - taken_[pc] : 0) << ","
+			<< loads[pc] << "," << stores[pc] << "\n";
+	}
+}
+
+bool runProfiled(CPU& cpu, const string& reportPath, const string& dumpPath)
+{
+	Profiler prof(cpu);
+	cpu.runObserved(prof);
+
+	if (!reportPath.empty()){
+		ofstream out(reportPath.c_str());
+		if (!out){
+			cerr << "can't write profile " << reportPath << "\n";
+			return false;
+		}
+		prof.writeReport(out, cpu, 50);
+	}
+	if (!dumpPath.empty()){
+		ofstream out(dumpPath.c_str());
+		if (!out){
+			cerr << "can't write profile dump " << dumpPath << "\n";
+			return false;
+		}
+		prof.writeDump(out, cpu);
+	}
+	return true;
+}
+
+bool SymbolMap::load(const string& path)
+{
+	ifstream in(path.c_str());
+	if (!in){
+		return false;
+	}
+	string line;
+	while (getline(in, line)){
+		istringstream fields(line);
+		string address, second, third;
+		if (!(fields >> address >> second) || address[0] == '#'){
+			continue;
+		}
+		char* end;
+		unsigned long value = strtoul(address.c_str(), &end, 16);
+		if (*end){
+			continue;
+		}
+		// "address name" or nm's "address type name"
+		symbols.push_back(make_pair((uint32_t)value, (fields >> third) ? third : second));
+	}
+	sort(symbols.begin(), symbols.end());
+	return true;
+}
+
+string SymbolMap::name(uint32_t address) const
+{
+	ostringstream out;
+	vector<pair<uint32_t, string> >::const_iterator s =
+		upper_bound(symbols.begin(), symbols.end(), make_pair(address, string("\xff")));
+	if (s == symbols.begin()){
+		out << "0x" << hex << address;
+		return out.str();
+	}
+	--s;
+	out << s->second;
+	if (s->first != address){
+		out << "+0x" << hex << address - s->first;
+	}
+	return out.str();
+}
+
+StackProfiler::StackProfiler(uint64_t interval)
+	: interval(interval ? interval : 1), countdown(this->interval), overflows(0)
+{
+	Node entry = { 0, 0 };
+	nodes.push_back(entry);
+	samples.push_back(0);
+	Frame bottom = { 0, UINT32_MAX };
+	stack.push_back(bottom);
+}
+
+void StackProfiler::jump(uint32_t pc, const DecodedOp& op, uint32_t next)
+{
+	bool rdLink = op.rd == 1 || op.rd == 5;
+	bool rs1Link = op.opclass == OP_JALR && (op.rs1 == 1 || op.rs1 == 5);
+	if (!rdLink){
+		if (rs1Link && op.rd == 0 && stack.size() > 1){
+			// return: unwind to the frame that returns here, or just the top one if none does
+			size_t depth = stack.size() - 1;
+			for (size_t d = stack.size() - 1; d > 0; d--){
+				if (stack[d].returnTo == next){
+					depth = d;
+					break;
+				}
+			}
+			stack.resize(depth);
+		}
+		return;
+	}
+	if (stack.size() >= MAX_DEPTH){
+		overflows++;
+		return;
+	}
+	uint32_t parent = stack.back().node;
+	uint64_t key = (uint64_t)parent << 32 | next;
+	unordered_map<uint64_t, uint32_t>::iterator child = children.find(key);
+	uint32_t node;
+	if (child != children.end()){
+		node = child->second;
+	}
+	else{
+		node = nodes.size();
+		Node n = { parent, next };
+		nodes.push_back(n);
+		samples.push_back(0);
+		children[key] = node;
+	}
+	Frame f = { node, pc + 1 };
+	stack.push_back(f);
+}
+
+void StackProfiler::writeFolded(ostream& out, const SymbolMap& symbols) const
+{
+	vector<string> names(nodes.size()); // full folded stack per node, parents come first
+	vector<string> lines;
+	for (size_t n = 0; n < nodes.size(); n++){
+		string function = symbols.name(4 * nodes[n].function);
+		names[n] = n ? names[nodes[n].parent] + ";" + function : function;
+		if (samples[n]){
+			lines.push_back(names[n] + " " + to_string(samples[n]));
+		}
+	}
+	sort(lines.begin(), lines.end());
+	for (size_t l = 0; l < lines.size(); l++){
+		out << lines[l] << "\n";
+	}
+}
+
+bool runStackProfile(CPU& cpu, const string& path, uint64_t interval, const string& symbolsPath)
+{
+	SymbolMap symbols;
+	if (!symbolsPath.empty() && !symbols.load(symbolsPath)){
+		cerr << "can't read symbols " << symbolsPath << "\n";
+		return false;
+	}
+	StackProfiler prof(interval);
+	cpu.runObserved(prof);
+
+	ofstream out(path.c_str());
+	if (!out){
+		cerr << "can't write stack profile " << path << "\n";
+		return false;
+	}
+	prof.writeFolded(out, symbols);
+	if (prof.truncated()){
+		cerr << "stack profile: " << prof.truncated() << " calls past the depth limit were charged to their caller\n";
+	}
+	return true;
+}
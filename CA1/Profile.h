@@ -0,0 +1,99 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "Observer.h"
+
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+/*
+Execution profile of one run on the reference engine: dynamic counts per instruction kind and per
+PC, taken/not-taken branch outcomes and load/store counts. Only built into the loop when you ask for it
+(runProfiled instantiates stepObserved with a Profiler); a normal run has no counting at all.
+*/
+class Profiler : public Observer {
+public:
+	Profiler(const CPU& cpu);
+
+	void onExec(uint32_t pc, const DecodedOp& op) { execs[pc]++; kinds[threadedKind(op)]++; }
+	void onLoad(uint32_t pc, uint32_t address, int bytes) { loads[pc]++; }
+	void onStore(uint32_t pc, uint32_t address, int bytes) { stores[pc]++; }
+	void onBranch(uint32_t pc, const DecodedOp& op, bool taken, uint32_t next) { if (isBranch(op.opclass) && taken) taken_[pc]++; }
+
+	// hottest PCs first (top of them, 0 = all), with a per-kind summary on top
+	void writeReport(ostream& out, const CPU& cpu, size_t top) const;
+	// every executed PC, one CSV row each: pc,address,word,kind,count,taken,not_taken,loads,stores
+	void writeDump(ostream& out, const CPU& cpu) const;
+
+private:
+	vector<uint64_t> execs, taken_, loads, stores; // indexed by PC
+	uint64_t kinds[T_NUMKINDS];
+};
+
+// run cpu to halt on the reference engine while profiling; reports go to the given files ("" = skip)
+bool runProfiled(CPU& cpu, const string& reportPath, const string& dumpPath);
+
+/*
+Guest symbols for naming functions: one "address name" per line, address in hex, or `nm` output
+("address type name"). An address that isn't a symbol gets the nearest one below it plus an
+offset, or just its hex value when there's none.
+*/
+class SymbolMap {
+public:
+	bool load(const string& path); // false if it can't be read
+	string name(uint32_t address) const;
+
+private:
+	vector<pair<uint32_t, string> > symbols; // sorted by address
+};
+
+/*
+Sampling call-stack profile. A shadow stack follows the guest's calls and returns the way the
+RISC-V return-address hints define them: JAL/JALR writing a link register (ra or t0) is a call,
+JALR through a link register with rd = x0 a return. A return pops back to the frame it returns
+into, so a longjmp-like unwind drops all the frames it skips. Jumps that link nothing (tail calls)
+leave the stack alone and are charged to the caller.
+The stacks form a calling-context tree, so a push is one hash lookup and a sample is one
+increment; every interval instructions the current stack gets a sample. writeFolded prints one
+"outer;...;inner count" line per stack, the input flamegraph.pl and speedscope take.
+*/
+class StackProfiler : public Observer {
+public:
+	StackProfiler(uint64_t interval);
+
+	void onExec(uint32_t pc, const DecodedOp& op)
+	{
+		if (--countdown == 0){
+			countdown = interval;
+			samples[stack.back().node]++;
+		}
+	}
+	void onBranch(uint32_t pc, const DecodedOp& op, bool taken, uint32_t next)
+	{
+		if (op.opclass == OP_JAL || op.opclass == OP_JALR) jump(pc, op, next);
+	}
+
+	void writeFolded(ostream& out, const SymbolMap& symbols) const;
+	uint64_t truncated() const { return overflows; } // calls not followed because the stack was full
+
+private:
+	static const size_t MAX_DEPTH = 1 << 16;
+
+	struct Frame { uint32_t node, returnTo; };
+	struct Node { uint32_t parent, function; }; // function: entry PC
+
+	uint64_t interval, countdown, overflows;
+	vector<Frame> stack;
+	vector<Node> nodes;     // [0] is the program's entry
+	vector<uint64_t> samples; // per node
+	unordered_map<uint64_t, uint32_t> children; // parent << 32 | function -> node
+
+	void jump(uint32_t pc, const DecodedOp& op, uint32_t next);
+};
+
+// run cpu to halt on the reference engine sampling the guest call stack every interval instructions;
+// folded stacks to path, named from symbolsPath if it isn't ""
+bool runStackProfile(CPU& cpu, const string& path, uint64_t interval, const string& symbolsPath);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,177 @@
+#include "Reuse.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+using namespace std;
+
+ReuseAnalyzer::ReuseAnalyzer(unsigned lineBytes, uint64_t window)
+	: lineBits(0), tree(1 << 16, 0), now(0), accesses(0), cold(0), window(window), executed(0), windowEnd(window),
+	windowIndex(1), windowLines(0)
+{
+	while ((1u << lineBits) < lineBytes) lineBits++;
+}
+
+void ReuseAnalyzer::mark(uint64_t time, int delta)
+{
+	for (; time < tree.size(); time += time & -time){
+		tree[time] += delta;
+	}
+}
+
+uint64_t ReuseAnalyzer::marked(uint64_t time) const
+{
+	uint64_t sum = 0;
+	for (; time; time -= time & -time){
+		sum += tree[time];
+	}
+	return sum;
+}
+
+void ReuseAnalyzer::compact()
+{
+	// renumber the marks 1..lines in time order (only their order matters)
+	vector<Line*> order;
+	order.reserve(lines.size());
+	for (auto& l : lines){
+		order.push_back(&l.second);
+	}
+	sort(order.begin(), order.end(), [](const Line* a, const Line* b) { return a->last < b->last; });
+	size_t size = tree.size();
+	while (size < 2 * (order.size() + 1)) size <<= 1;
+	tree.assign(size, 0);
+	for (size_t i = 0; i < order.size(); i++){
+		order[i]->last = i + 1;
+		tree[i + 1] = 1;
+	}
+	// linear-time build: push each node's sum up to its parent
+	for (uint64_t i = 1; i < size; i++){
+		uint64_t parent = i + (i & -i);
+		if (parent < size) tree[parent] += tree[i];
+	}
+	now = order.size();
+}
+
+void ReuseAnalyzer::touch(uint32_t line)
+{
+	if (now + 1 >= tree.size()){
+		compact();
+	}
+	now++;
+	accesses++;
+	auto it = lines.find(line);
+	if (it == lines.end()){
+		cold++;
+		Line l = { now, windowIndex };
+		lines.emplace(line, l);
+		windowLines++;
+	}
+	else{
+		uint64_t distance = marked(now - 1) - marked(it->second.last);
+		if (distance >= hist.size()){
+			hist.resize(distance + 1, 0);
+		}
+		hist[distance]++;
+		mark(it->second.last, -1);
+		it->second.last = now;
+		if (it->second.window != windowIndex){
+			it->second.window = windowIndex;
+			windowLines++;
+		}
+	}
+	mark(now, 1);
+}
+
+void ReuseAnalyzer::closeWindow()
+{
+	working.push_back(windowLines);
+	windowLines = 0;
+	windowIndex++;
+	windowEnd += window;
+}
+
+void ReuseAnalyzer::finish()
+{
+	if (executed > windowEnd - window){ // the open window has instructions in it
+		closeWindow();
+	}
+}
+
+// "64 B", "32 KB", "4 MB"
+static string sizeName(uint64_t bytes)
+{
+	if (bytes >= (1 << 20) && bytes % (1 << 20) == 0) return to_string(bytes >> 20) + " MB";
+	if (bytes >= (1 << 10) && bytes % (1 << 10) == 0) return to_string(bytes >> 10) + " KB";
+	return to_string(bytes) + " B";
+}
+
+void ReuseAnalyzer::writeReport(ostream& out) const
+{
+	uint64_t line = 1ull << lineBits;
+	out << fixed << setprecision(2);
+	out << "line size " << line << " B, " << accesses << " line accesses, " << lines.size() << " distinct lines ("
+		<< sizeName(lines.size() * line) << "), " << cold << " cold\n";
+
+	// histogram in power-of-two buckets: 0, 1, 2-3, 4-7, ...
+	out << "\nreuse distance (lines)        count        %   cumul%\n";
+	uint64_t cumul = 0;
+	for (uint64_t lo = 0; lo < hist.size(); lo = lo ? 2*lo : 1){
+		uint64_t hi = lo ? min<uint64_t>(2*lo, hist.size()) : 1, count = 0;
+		for (uint64_t d = lo; d < hi; d++){
+			count += hist[d];
+		}
+		cumul += count;
+		string range = (hi - lo == 1) ? to_string(lo) : to_string(lo) + "-" + to_string(hi - 1);
+		out << "  " << left << setw(20) << range << right << setw(13) << count
+			<< setw(9) << 100.0 * count / accesses << setw(9) << 100.0 * cumul / accesses << "\n";
+	}
+	out << "  " << left << setw(20) << "cold" << right << setw(13) << cold
+		<< setw(9) << (accesses ? 100.0 * cold / accesses : 0.0) << "\n";
+
+	// fully associative LRU of C lines misses the cold accesses and those with distance >= C
+	out << "\nfully associative LRU     lines          size       misses   miss%\n";
+	uint64_t beyond = accesses - cold; // reuses with distance >= lines
+	uint64_t d = 0;
+	for (uint64_t capacity = 1; ; capacity *= 2){
+		for (; d < capacity && d < hist.size(); d++){
+			beyond -= hist[d];
+		}
+		out << "  " << setw(30) << capacity << setw(14) << sizeName(capacity * line) << setw(13) << cold + beyond
+			<< setw(8) << (accesses ? 100.0 * (cold + beyond) / accesses : 0.0) << "\n";
+		if (beyond == 0){
+			break;
+		}
+	}
+
+	if (working.empty()){
+		return;
+	}
+	uint64_t lo = working[0], hi = 0, sum = 0;
+	for (size_t w = 0; w < working.size(); w++){
+		lo = min(lo, working[w]);
+		hi = max(hi, working[w]);
+		sum += working[w];
+	}
+	out << "\nworking set per " << window << " instructions (" << working.size() << " windows): min "
+		<< sizeName(lo * line) << ", average " << sizeName(sum / working.size() * line) << ", max " << sizeName(hi * line) << "\n";
+	out << "     window   first instruction     lines          size\n";
+	for (size_t w = 0; w < working.size(); w++){
+		out << setw(11) << w << setw(20) << w * window << setw(10) << working[w] << setw(14) << sizeName(working[w] * line) << "\n";
+	}
+}
+
+bool runReuse(CPU& cpu, unsigned lineBytes, uint64_t window, const string& reportPath)
+{
+	ReuseAnalyzer reuse(lineBytes, window);
+	cpu.runObserved(reuse);
+	reuse.finish();
+
+	ofstream out(reportPath.c_str());
+	if (!out){
+		cerr << "can't write reuse report " << reportPath << "\n";
+		return false;
+	}
+	reuse.writeReport(out);
+	return true;
+}
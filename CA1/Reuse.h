@@ -0,0 +1,74 @@
+#ifndef REUSE_H
+#define REUSE_H
+
+#include "Observer.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+/*
+Reuse (LRU stack) distance of every load and store at cache-line granularity, plus the working set
+of each window of instructions. The distance of an access is the number of distinct other lines
+touched since the last access to its line, so a fully associative LRU cache of C lines hits exactly
+the accesses with distance < C: one pass gives the miss rate of every such cache at once.
+
+Each line's last access time is marked in a Fenwick tree over time, so the distinct lines since
+then are a prefix-sum difference: O(log n) per access. Only the latest access to a line keeps a
+mark; when time runs off the end of the tree the marks are renumbered 1..lines and the tree rebuilt,
+which happens at most once per lines-many accesses. An access that straddles a line touches both.
+*/
+class ReuseAnalyzer : public Observer {
+public:
+	ReuseAnalyzer(unsigned lineBytes, uint64_t window);
+
+	void onExec(uint32_t pc, const DecodedOp& op)
+	{
+		if (executed++ == windowEnd){ // the first instruction past the window: its accesses go in the next
+			closeWindow();
+		}
+	}
+	void onLoad(uint32_t pc, uint32_t address, int bytes) { access(address, bytes); }
+	void onStore(uint32_t pc, uint32_t address, int bytes) { access(address, bytes); }
+
+	void finish(); // close the last (partial) window
+	// distance histogram, miss-rate curve and working sets
+	void writeReport(ostream& out) const;
+
+private:
+	struct Line {
+		uint64_t last;   // time of the latest access (its mark in the tree)
+		uint64_t window; // last window it was counted in
+	};
+
+	unsigned lineBits;
+	unordered_map<uint32_t, Line> lines;
+	vector<uint32_t> tree; // Fenwick tree over times 1..tree.size()-1
+	uint64_t now;          // time of the latest access
+	uint64_t accesses, cold;
+	vector<uint64_t> hist; // accesses by exact distance
+
+	uint64_t window, executed, windowEnd, windowIndex;
+	uint64_t windowLines;     // distinct lines in the current window
+	vector<uint64_t> working; // distinct lines per finished window
+
+	void access(uint32_t address, int bytes)
+	{
+		uint32_t last = address + bytes - 1;
+		touch(address >> lineBits);
+		if ((last ^ address) >> lineBits){
+			touch(last >> lineBits);
+		}
+	}
+	void touch(uint32_t line);
+	void mark(uint64_t time, int delta);
+	uint64_t marked(uint64_t time) const; // marks at times 1..time
+	void compact();
+	void closeWindow();
+};
+
+// run cpu to halt on the reference engine through the analyzer; report to the given file
+bool runReuse(CPU& cpu, unsigned lineBytes, uint64_t window, const string& reportPath);
+
+#endif /* REUSE_H */
@@ -0,0 +1,146 @@
+#include "Simulator.h"
+#include "Loader.h"
+#include "libcpusim.h"
+
+Simulator::Simulator() : version(0), engine(ENGINE_INTERP)
+{
+	core.predecode(words); // an empty program: just the halt slot
+}
+
+bool Simulator::load(const string& path)
+{
+	vector<uint32_t> image;
+	if (!loadImage(path.c_str(), image)){
+		return false;
+	}
+	load(image);
+	return true;
+}
+
+void Simulator::load(const vector<uint32_t>& image)
+{
+	words = image;
+	core.reset();
+	core.predecode(words);
+	version = core.codeVersion;
+}
+
+bool Simulator::setEngine(const string& name)
+{
+	return parseEngine(name, engine);
+}
+
+void Simulator::reset()
+{
+	core.reset();
+	if (core.codeVersion != version){ // the guest stored into its code: decode the original again
+		core.predecode(words);
+		version = core.codeVersion;
+	}
+}
+
+uint64_t Simulator::run(uint64_t limit)
+{
+	uint64_t before = core.instret;
+	core.run(engine, false, limit);
+	return core.instret - before;
+}
+
+void Simulator::read(uint32_t address, void* data, size_t len)
+{
+	uint8_t* out = (uint8_t*)data;
+	for (size_t i = 0; i < len; i++){
+		out[i] = core.loadbyteunsigned(address + i);
+	}
+}
+
+void Simulator::write(uint32_t address, const void* data, size_t len)
+{
+	const uint8_t* in = (const uint8_t*)data;
+	for (size_t i = 0; i < len; i++){
+		core.storebyte(address + i, in[i]);
+	}
+}
+
+// the C interface: a cpusim is a Simulator
+struct cpusim : Simulator {
+};
+
+extern "C" {
+
+cpusim* cpusim_new(void)
+{
+	return new cpusim();
+}
+
+void cpusim_free(cpusim* sim)
+{
+	delete sim;
+}
+
+int cpusim_load_file(cpusim* sim, const char* path)
+{
+	return sim->load(path) ? 0 : -1;
+}
+
+void cpusim_load_words(cpusim* sim, const uint32_t* words, size_t count)
+{
+	sim->load(vector<uint32_t>(words, words + count));
+}
+
+int cpusim_set_engine(cpusim* sim, const char* name)
+{
+	return sim->setEngine(name) ? 0 : -1;
+}
+
+void cpusim_reset(cpusim* sim)
+{
+	sim->reset();
+}
+
+uint64_t cpusim_run(cpusim* sim, uint64_t max)
+{
+	return sim->run(max);
+}
+
+int cpusim_halted(cpusim* sim)
+{
+	return sim->halted() ? 1 : 0;
+}
+
+int32_t cpusim_get_reg(cpusim* sim, unsigned reg)
+{
+	return sim->reg(reg);
+}
+
+void cpusim_set_reg(cpusim* sim, unsigned reg, int32_t value)
+{
+	sim->setReg(reg, value);
+}
+
+uint32_t cpusim_get_pc(cpusim* sim)
+{
+	return sim->pc();
+}
+
+void cpusim_set_pc(cpusim* sim, uint32_t address)
+{
+	sim->setPC(address);
+}
+
+void cpusim_read_mem(cpusim* sim, uint32_t address, void* data, size_t len)
+{
+	sim->read(address, data, len);
+}
+
+void cpusim_write_mem(cpusim* sim, uint32_t address, const void* data, size_t len)
+{
+	sim->write(address, data, len);
+}
+
+uint64_t cpusim_instret(cpusim* sim)
+{
+	return sim->instret();
+}
+
+}
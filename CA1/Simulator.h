@@ -0,0 +1,48 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "CPU.h"
+
+#include <string>
+#include <vector>
+using namespace std;
+
+/*
+One simulated machine for embedding (the C++ side of libcpusim; libcpusim.h is the C side).
+load() parses an image once and keeps its words; reset() puts the machine back to where the load left
+it without allocating anything: registers, PC and instret go to 0, the data pages already allocated
+are zeroed in place, and the program is decoded again only if the guest stored into it. Instances
+share nothing, so each thread can drive its own.
+*/
+class Simulator {
+public:
+	Simulator();
+
+	bool load(const string& path); // false if the file can't be read
+	void load(const vector<uint32_t>& words);
+	bool setEngine(const string& name); // interp (default), threaded, blocks or jit; false if unknown
+	void reset();
+
+	// run limit more instructions, or to halt; returns how many ran. Every engine stops on the exact
+	// count; threaded and jit hand the last few (at most the program's length) to the reference engine.
+	uint64_t run(uint64_t limit = UINT64_MAX);
+	bool halted() { return core.halted(); }
+
+	int32_t reg(unsigned r) const { return core.regfile[r & 31]; }
+	void setReg(unsigned r, int32_t value) { if (r & 31) core.regfile[r & 31] = value; } // x0 stays 0
+	uint32_t pc() { return 4 * core.readPC(); } // byte address
+	void setPC(uint32_t address) { core.setPC(address / 4); }
+	void read(uint32_t address, void* data, size_t len);        // guest memory (and the image below codeBytes)
+	void write(uint32_t address, const void* data, size_t len); // stores into the image re-decode it
+	uint64_t instret() const { return core.instret; }
+
+	CPU& cpu() { return core; }
+
+private:
+	CPU core;
+	vector<uint32_t> words;  // the image as loaded
+	unsigned long version;   // core.codeVersion when program[] last matched words
+	Engine engine;
+};
+
+#endif /* SIMULATOR_H */
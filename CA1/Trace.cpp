@@ -0,0 +1,293 @@
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#include <unistd.h>
+#define HAVE_WRITEV 1
+#endif
+using namespace std;
+
+static bool endsWith(const string& s, const char* suffix)
+{
+	size_t n = strlen(suffix);
+	return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// compressor for a trace name, NULL for none
+static const char* compressorFor(const string& path)
+{
+	return endsWith(path, ".gz") ? "gzip" : endsWith(path, ".bz2") ? "bzip2" : endsWith(path, ".xz") ? "xz" : NULL;
+}
+
+TraceFile::TraceFile(size_t ringBytes)
+	: fp(NULL), pipe(false), head(0), tailSeen(0), stalls(0), stallSeconds(0), published(0), drained(0),
+	closing(false), failed(false)
+{
+	size_t size = BLOCK;
+	while (size < ringBytes) size <<= 1;
+	ring.resize(size);
+	base = ring.data();
+	mask = size - 1;
+	block = min(BLOCK, size / 4);
+}
+
+bool TraceFile::open(const string& path)
+{
+	close();
+	const char* compressor = compressorFor(path);
+	if (path == "-"){
+		fflush(stdout); // we write to the descriptor from now on
+		fp = stdout;
+	}
+	else if (compressor){
+		string cmd = string(compressor) + " -c > '" + path + "'";
+		fp = popen(cmd.c_str(), "w");
+		pipe = true;
+	}
+	else{
+		fp = fopen(path.c_str(), "wb");
+	}
+	if (!fp){
+		cerr << "can't write trace " << path << "\n";
+		pipe = false;
+		return false;
+	}
+	head = tailSeen = 0;
+	published = drained = 0;
+	closing = failed = false;
+	writer = thread(&TraceFile::drain, this);
+	return true;
+}
+
+void TraceFile::writeSlow(const char* data, size_t len)
+{
+	// anything bigger than half the ring goes in pieces
+	size_t piece = ring.size() / 2;
+	while (len > piece){
+		writeSlow(data, piece);
+		data += piece;
+		len -= piece;
+	}
+	tailSeen = drained.load(memory_order_acquire);
+	if (head + len - tailSeen > ring.size()){
+		// full: wake the writer and wait for it to make room
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		stalls++;
+		wake.notify_one();
+		while (head + len - (tailSeen = drained.load(memory_order_acquire)) > ring.size()){
+			this_thread::yield();
+		}
+		stallSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+	size_t at = head & mask, first = min(len, ring.size() - at);
+	memcpy(base + at, data, first);
+	memcpy(base, data + first, len - first);
+	head += len;
+	published.store(head, memory_order_release);
+}
+
+// hand ring bytes [from, to) to the file: one piece, or two if they wrap round the end
+void TraceFile::put(uint64_t from, uint64_t to)
+{
+	size_t at = from & mask, len = to - from, first = min(len, ring.size() - at);
+#ifdef HAVE_WRITEV
+	struct iovec pieces[2] = { { &ring[at], first }, { &ring[0], len - first } };
+	int n = (len > first) ? 2 : 1;
+	struct iovec* iov = pieces;
+	int fd = fileno(fp);
+	while (n > 0){
+		ssize_t done = writev(fd, iov, n);
+		if (done < 0){
+			failed = true;
+			return;
+		}
+		// a short write: skip what went out and go again
+		while (n > 0 && (size_t)done >= iov->iov_len){
+			done -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0){
+			iov->iov_base = (char*)iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+#else
+	if (fwrite(&ring[at], 1, first, fp) != first || fwrite(&ring[0], 1, len - first, fp) != len - first){
+		failed = true;
+	}
+#endif
+}
+
+void TraceFile::drain()
+{
+	uint64_t tail = 0;
+	for (;;){
+		// closing first: once it's set, published already holds the last write
+		bool last = closing.load(memory_order_acquire);
+		uint64_t end = published.load(memory_order_acquire);
+		if (end - tail < block && !last){
+			unique_lock<mutex> hold(lock);
+			wake.wait_for(hold, chrono::milliseconds(1));
+			continue;
+		}
+		if (end != tail){
+			if (!failed) put(tail, end); // after a failure just keep the producer going
+			tail = end;
+			drained.store(tail, memory_order_release);
+		}
+		if (last){
+			return;
+		}
+	}
+}
+
+void TraceFile::writeStats(ostream& out, const string& what) const
+{
+	ios::fmtflags flags = out.flags();
+	streamsize precision = out.precision();
+	out << what << ": " << head << " bytes, producer stalled " << stalls << " times (" << fixed
+		<< setprecision(1) << stallSeconds * 1000 << " ms) on a " << ring.size() / 1024 << " KB ring\n";
+	out.flags(flags);
+	out.precision(precision);
+}
+
+bool TraceFile::close()
+{
+	if (!fp){
+		return true;
+	}
+	closing.store(true, memory_order_release);
+	wake.notify_one();
+	writer.join();
+	bool ok = !failed && !ferror(fp);
+	if (pipe) ok = pclose(fp) == 0 && ok;
+	else if (fp == stdout) ok = fflush(fp) == 0 && ok;
+	else ok = fclose(fp) == 0 && ok;
+	fp = NULL;
+	pipe = false;
+	return ok;
+}
+
+int procsimClass(const DecodedOp& op)
+{
+	switch (op.opclass){
+		case OP_RTYPE:
+		case OP_ITYPE:
+			if (op.rd == 0) return -1; // includes FENCE and the usual nop
+			switch (op.aluop){
+				case ALU_SLL: case ALU_SRL: case ALU_SRA:
+				case ALU_SLT: case ALU_SLTU:
+					return 1;
+				default:
+					return 0;
+			}
+		case OP_LUI:
+		case OP_AUIPC:
+		case OP_CSR:
+			return (op.rd == 0) ? -1 : 0;
+		default:
+			if (isLoad(op.opclass) || isStore(op.opclass)) return 2;
+			return -1; // branches and jumps
+	}
+}
+
+ProcsimTracer::ProcsimTracer(const CPU& cpu, TraceFile& out)
+	: cpu(cpu), out(out), lines(cpu.program.size()), version(cpu.codeVersion)
+{
+}
+
+void procsimRegs(const DecodedOp& op, int& dest, int& src1, int& src2)
+{
+	// which fields the instruction actually reads and writes
+	dest = op.rd ? op.rd : -1;
+	src1 = src2 = -1;
+	if (op.opclass != OP_LUI && op.opclass != OP_AUIPC && op.opclass != OP_JAL && op.rs1){
+		src1 = op.rs1;
+	}
+	if ((op.opclass == OP_RTYPE || isStore(op.opclass) || isBranch(op.opclass)) && op.rs2){
+		src2 = op.rs2;
+	}
+}
+
+string ProcsimTracer::format(uint32_t pc, const DecodedOp& op)
+{
+	int dest, src1, src2;
+	procsimRegs(op, dest, src1, src2);
+	char line[64];
+	snprintf(line, sizeof(line), "%x %d %d %d %d\n", 4*pc, procsimClass(op), dest, src1, src2);
+	return line;
+}
+
+bool runProcsimTrace(CPU& cpu, const string& path, uint64_t limit, size_t ringBytes)
+{
+	TraceFile out(ringBytes);
+	if (!out.open(path)){
+		return false;
+	}
+	ProcsimTracer tracer(cpu, out);
+	for (uint64_t i = 0; i < limit && cpu.stepObserved(tracer) != STEP_HALT; i++){
+	}
+	if (!out.close()){
+		cerr << "error writing trace " << path << "\n";
+		return false;
+	}
+	out.writeStats(cerr, "procsim trace " + path);
+	return true;
+}
+
+int cbpJumpCode(const DecodedOp& op)
+{
+	bool rdLink = op.rd == 1 || op.rd == 5;
+	bool rs1Link = op.rs1 == 1 || op.rs1 == 5;
+	if (op.opclass == OP_JAL){
+		return rdLink ? CBP_CALL : CBP_JUMP;
+	}
+	if (rdLink){ // includes the pop-then-push "coroutine" form rd != rs1, both links
+		return CBP_INDIRECT_CALL;
+	}
+	return rs1Link ? CBP_RETURN : CBP_INDIRECT;
+}
+
+bool runCBPTrace(CPU& cpu, const string& path, const string& ct, uint64_t limit, size_t ringBytes)
+{
+	string raw = ct.empty() ? path : path + ".raw";
+	TraceFile out(ringBytes);
+	if (!out.open(ct.empty() ? path : raw)){
+		return false;
+	}
+	CBPTracer tracer(out);
+	for (uint64_t i = 0; i < limit && cpu.stepObserved(tracer) != STEP_HALT; i++){
+	}
+	if (!out.close()){
+		cerr << "error writing trace " << raw << "\n";
+		return false;
+	}
+	out.writeStats(cerr, "branch trace " + raw);
+	if (ct.empty()){
+		return true;
+	}
+	// ct wants a file name (it sniffs the compression from the first bytes) and talks a lot on stderr;
+	// run it and the compressor separately so a failing ct isn't hidden behind the pipe
+	const char* compressor = compressorFor(path);
+	string pre = compressor ? path + ".ct" : path;
+	string cmd = "'" + ct + "' -c '" + raw + "' > '" + pre + "' 2>/dev/null";
+	bool ok = system(cmd.c_str()) == 0;
+	if (ok && compressor){
+		cmd = string(compressor) + " -c '" + pre + "' > '" + path + "'";
+		ok = system(cmd.c_str()) == 0;
+	}
+	if (compressor){
+		remove(pre.c_str());
+	}
+	remove(raw.c_str());
+	if (!ok){
+		cerr << "`" << cmd << "` failed\n";
+	}
+	return ok;
+}
@@ -0,0 +1,177 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "Observer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+using namespace std;
+
+/*
+Output file for traces. A name ending in .gz, .bz2 or .xz is piped through that compressor (like
+the CA2 trace reader does the other way round), "-" is stdout, anything else is a plain file.
+The simulation thread never does the I/O itself: write() copies into a single-producer/single-
+consumer ring and publishes the new head with one release store, and a writer thread drains the
+ring a block at a time with writev (two pieces when the data wraps round the end). Only when the
+ring is full does the producer wait; those stalls are counted so a run can tell whether its buffer
+(or its disk, or its compressor) keeps up.
+*/
+class TraceFile {
+public:
+	static const size_t DEFAULT_RING = 4 << 20;
+
+	TraceFile(size_t ringBytes = DEFAULT_RING); // rounded up to a power of two, at least 64 KB
+	~TraceFile() { close(); }
+
+	bool open(const string& path); // false (with a message on stderr) if it can't be created
+	bool close();                  // drain and close; false if anything failed to write
+
+	void write(const char* data, size_t len)
+	{
+		size_t at = head & mask;
+		if (head + len - tailSeen > mask + 1 || at + len > mask + 1){ // full, or wraps round the end
+			writeSlow(data, len);
+			return;
+		}
+		memcpy(base + at, data, len);
+		head += len;
+		published.store(head, memory_order_release);
+	}
+
+	// "<what>: <bytes> bytes, producer stalled <n> times (<ms> ms) on a <size> KB ring"
+	void writeStats(ostream& out, const string& what) const;
+
+private:
+	static const size_t BLOCK = 64 << 10; // the writer waits for this much (or close) before writing
+
+	vector<char> ring;
+	char* base;         // ring.data()
+	size_t mask, block; // block: BLOCK, or a quarter of a small ring so a full one always gets drained
+	FILE* fp;
+	bool pipe;
+
+	// producer side
+	uint64_t head;     // bytes written so far
+	uint64_t tailSeen; // drained as of our last look
+	uint64_t stalls;
+	double stallSeconds;
+
+	// shared with the writer thread
+	atomic<uint64_t> published, drained;
+	atomic<bool> closing, failed;
+	mutex lock;
+	condition_variable wake;
+	thread writer;
+
+	void writeSlow(const char* data, size_t len);
+	void drain(); // the writer thread
+	void put(uint64_t from, uint64_t to);
+
+	TraceFile(const TraceFile&);
+	TraceFile& operator=(const TraceFile&);
+};
+
+// procsim functional-unit class of an instruction: 0 add/sub/logic/LUI/AUIPC, 1 shifts and compares,
+// 2 loads and stores, -1 for branches, jumps and no-ops (procsim runs those on a k1 unit)
+int procsimClass(const DecodedOp& op);
+// procsim destination and source registers of an instruction, -1 for those it doesn't use (or x0)
+void procsimRegs(const DecodedOp& op, int& dest, int& src1, int& src2);
+
+/*
+Dynamic instruction trace in the format CA3/procsim reads: one "address opcode dest src1 src2" line
+per executed instruction, address in hex, registers -1 when not used (x0 counts as not used, it
+never carries a dependence). The line of each static instruction is formatted the first time it runs
+and then copied, so tracing costs little more than the reference engine itself.
+*/
+class ProcsimTracer : public Observer {
+public:
+	ProcsimTracer(const CPU& cpu, TraceFile& out);
+
+	void onExec(uint32_t pc, const DecodedOp& op)
+	{
+		if (cpu.codeVersion != version){ // the program changed under us: reformat everything
+			lines.assign(lines.size(), string());
+			version = cpu.codeVersion;
+		}
+		string& line = lines[pc];
+		if (line.empty()){
+			line = format(pc, op);
+		}
+		out.write(line.data(), line.size());
+	}
+
+private:
+	const CPU& cpu;
+	TraceFile& out;
+	vector<string> lines; // formatted line per PC, "" until it first runs
+	unsigned long version;
+
+	static string format(uint32_t pc, const DecodedOp& op);
+};
+
+// run cpu to halt (or limit instructions) on the reference engine writing a procsim trace to path
+// through a ring of ringBytes; the writer's stall count goes to stderr
+bool runProcsimTrace(CPU& cpu, const string& path, uint64_t limit, size_t ringBytes = TraceFile::DEFAULT_RING);
+
+// CBP-2 record codes (upper four bits of the code byte, see CA2/src/trace.cc)
+enum CBPCode {
+	CBP_TAKEN = 1, CBP_NOT_TAKEN, CBP_JUMP, CBP_INDIRECT, CBP_CALL, CBP_INDIRECT_CALL, CBP_RETURN
+};
+
+// JAL/JALR as the return-address-stack hints in the RISC-V spec see them (x1 and x5 are link registers)
+int cbpJumpCode(const DecodedOp& op);
+
+// x86 condition a conditional branch corresponds to (the low four bits of its CBP-2 code)
+inline uint8_t cbpCondition(const DecodedOp& op)
+{
+	static const uint8_t x86cond[6] = { 4, 5, 12, 13, 2, 3 }; // BEQ..BGEU -> JZ JNZ JL JGE JC JNC
+	return x86cond[op.opclass - OP_BEQ];
+}
+
+/*
+Branch trace in the CBP-2 format CA2's predict reads: a 9-byte record per executed branch or jump,
+	u8 code (kind << 4 | x86 condition), u32 address, u32 target, little-endian
+Conditional branches carry the x86 condition they correspond to (BEQ = JZ, BLT = JL, BLTU = JC, ...)
+and their encoded target whether taken or not; jumps carry where they went.
+*/
+class CBPTracer : public Observer {
+public:
+	CBPTracer(TraceFile& out) : out(out), records(0) {}
+
+	void onBranch(uint32_t pc, const DecodedOp& op, bool taken, uint32_t next)
+	{
+		uint8_t rec[9];
+		uint32_t target;
+		if (isBranch(op.opclass)){
+			rec[0] = (taken ? CBP_TAKEN : CBP_NOT_TAKEN) << 4 | cbpCondition(op);
+			target = 4*pc + op.imm;
+		}
+		else{
+			rec[0] = cbpJumpCode(op) << 4;
+			target = 4*next;
+		}
+		writeLE32(rec + 1, 4*pc);
+		writeLE32(rec + 5, target);
+		out.write((const char*)rec, sizeof(rec));
+		records++;
+	}
+	uint64_t count() const { return records; }
+
+private:
+	TraceFile& out;
+	uint64_t records;
+};
+
+// run cpu to halt (or limit instructions) writing a CBP-2 branch trace to path. With ct set (the
+// CA2/src/compress tool) the raw trace goes to a temporary file first and path gets `ct -c` of it,
+// compressed according to its name like any other trace.
+bool runCBPTrace(CPU& cpu, const string& path, const string& ct, uint64_t limit, size_t ringBytes = TraceFile::DEFAULT_RING);
+
+#endif /* TRACE_H */
@@ -0,0 +1,301 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+/*
+Synthetic workload generator: writes a random but reproducible program in the hex image format
+cpusim reads, and prints the manifest line for it (see Batch.h) with the (a0,a1) it must end with.
+
+	cpusim-gen -o prog.txt [--instructions n] [--body n<=1000] [--branches f] [--random-branches f]
+	           [--mem f] [--stores f] [--footprint bytes] [--seed n]
+
+Only the instructions the original assignment decoder understood are used (ADD SUB OR AND SRA,
+ADDI ORI ANDI SLTIU, LUI, LW LBU, SW SH, BNE), so the images run on every version of the simulator.
+The program is one loop whose body has --body instructions (default 64):
+	--branches f         fraction of body slots that start a forward BNE over 1-3 ALU ops (0.1)
+	--random-branches f  fraction of those that test a pseudo-random bit instead of a bit of the
+	                     loop counter, i.e. that no predictor can learn (0.5)
+	--mem f              fraction of slots that are a load or store (0.25), --stores f of them stores (0.3)
+	--footprint bytes    size of the data window they walk through, a power of two (64k)
+	--instructions n     dynamic instruction count to aim for (1m), sets the trip count
+Counts take k/m/g suffixes (powers of 1000), byte sizes too (powers of 1024). The expected result
+comes from running the generated code on a small model of those instructions here, independent of
+the simulator, which also gives the exact dynamic instruction count.
+*/
+
+enum GenKind {
+	G_ADD, G_SUB, G_OR, G_AND, G_SRA, G_ADDI, G_ORI, G_ANDI, G_SLTIU, G_LUI, G_LW, G_LBU, G_SW, G_SH, G_BNE
+};
+
+struct GenOp {
+	uint8_t kind, rd, rs1, rs2;
+	int32_t imm; // LUI: the upper 20 bits, BNE: offset in instructions
+};
+
+static uint32_t encode(const GenOp& g)
+{
+	uint32_t rd = g.rd, rs1 = g.rs1, rs2 = g.rs2, imm = g.imm;
+	uint32_t r = rs2 << 20 | rs1 << 15 | rd << 7 | 0x33;
+	uint32_t i = (imm & 0xFFF) << 20 | rs1 << 15 | rd << 7 | 0x13;
+	uint32_t s = (imm >> 5 & 0x7F) << 25 | rs2 << 20 | rs1 << 15 | (imm & 31) << 7 | 0x23;
+	switch (g.kind){
+		case G_ADD: return r;
+		case G_SUB: return r | 0x20u << 25;
+		case G_OR: return r | 6 << 12;
+		case G_AND: return r | 7 << 12;
+		case G_SRA: return r | 0x20u << 25 | 5 << 12;
+		case G_ADDI: return i;
+		case G_ORI: return i | 6 << 12;
+		case G_ANDI: return i | 7 << 12;
+		case G_SLTIU: return i | 3 << 12;
+		case G_LUI: return (imm & 0xFFFFF) << 12 | rd << 7 | 0x37;
+		case G_LW: return (i & ~0x7Fu) | 2 << 12 | 0x03;
+		case G_LBU: return (i & ~0x7Fu) | 4 << 12 | 0x03;
+		case G_SW: return s | 2 << 12;
+		case G_SH: return s | 1 << 12;
+		default: { // G_BNE
+			uint32_t o = 4 * imm;
+			return (o >> 12 & 1) << 31 | (o >> 5 & 0x3F) << 25 | rs2 << 20 | rs1 << 15 | 1 << 12
+				| (o >> 1 & 0xF) << 8 | (o >> 11 & 1) << 7 | 0x63;
+		}
+	}
+}
+
+// registers with fixed jobs; everything else is fair game for the random ALU ops
+enum {
+	R_A0 = 10, R_A1 = 11,
+	R_MASKBIT = 21, // the bit a random branch tests
+	R_RNG2 = 23, R_TMP = 24, R_MASK = 25, R_ADDR = 27, R_INDEX = 28, R_RNG = 29, R_BASE = 30, R_COUNT = 31
+};
+static const uint32_t DATA_BASE = 0x100000;
+
+static bool isScratch(int r) { return r >= 1 && r <= 20 && r != R_A0 && r != R_A1; }
+
+class Generator {
+public:
+	vector<GenOp> code;
+
+	Generator(uint64_t seed) : rng(seed) {}
+
+	void op(int kind, int rd, int rs1, int rs2, int32_t imm) { code.push_back(GenOp{ (uint8_t)kind, (uint8_t)rd, (uint8_t)rs1, (uint8_t)rs2, imm }); }
+	void li(int rd, uint32_t value)
+	{
+		op(G_LUI, rd, 0, 0, (value + 0x800) >> 12);
+		op(G_ADDI, rd, rd, 0, (int32_t)(value << 20) >> 20);
+	}
+
+	int scratch()
+	{
+		int r;
+		do r = 1 + rng() % 20; while (!isScratch(r));
+		return r;
+	}
+	double uniform() { return uniform_real_distribution<double>(0, 1)(rng); }
+	uint32_t below(uint32_t n) { return rng() % n; }
+	uint32_t bits() { return rng(); }
+
+	// one random ALU op on the scratch registers; add/sub-heavy so values keep their entropy
+	void alu()
+	{
+		static const int kinds[] = { G_ADD, G_ADD, G_SUB, G_SUB, G_ADDI, G_ADDI, G_OR, G_AND, G_SRA, G_ORI, G_ANDI, G_SLTIU, G_LUI };
+		int kind = kinds[below(sizeof(kinds) / sizeof(kinds[0]))];
+		int32_t imm = (int32_t)below(4096) - 2048;
+		// one draw at a time so the same seed gives the same program whatever the compiler
+		int rd = scratch(), rs1 = scratch(), rs2 = scratch();
+		if (kind == G_LUI) op(G_LUI, rd, 0, 0, bits() & 0xFFFFF);
+		else if (kind <= G_SRA) op(kind, rd, rs1, rs2, 0);
+		else op(kind, rd, rs1, 0, imm);
+	}
+
+private:
+	mt19937_64 rng;
+};
+
+// the model: runs the generated code, returns the dynamic instruction count
+static uint64_t model(const vector<GenOp>& code, uint32_t footprint, int32_t x[32])
+{
+	vector<uint8_t> data(footprint, 0);
+	uint64_t count = 0;
+	size_t pc = 0;
+	for (int r = 0; r < 32; r++) x[r] = 0;
+	while (pc < code.size()){
+		const GenOp& g = code[pc];
+		uint32_t a = x[g.rs1], b = x[g.rs2];
+		uint32_t address = a + g.imm - DATA_BASE; // loads/stores only ever touch [base, base + footprint)
+		int32_t v = 0;
+		bool writes = true;
+		count++;
+		pc++;
+		switch (g.kind){
+			case G_ADD: v = a + b; break;
+			case G_SUB: v = a - b; break;
+			case G_OR: v = a | b; break;
+			case G_AND: v = a & b; break;
+			case G_SRA: v = (int32_t)a >> (b & 31); break;
+			case G_ADDI: v = a + g.imm; break;
+			case G_ORI: v = a | g.imm; break;
+			case G_ANDI: v = a & g.imm; break;
+			case G_SLTIU: v = a < (uint32_t)g.imm; break;
+			case G_LUI: v = (uint32_t)g.imm << 12; break;
+			case G_LW: v = data[address] | data[address + 1] << 8 | data[address + 2] << 16 | (uint32_t)data[address + 3] << 24; break;
+			case G_LBU: v = data[address]; break;
+			case G_SW: data[address + 2] = b >> 16; data[address + 3] = b >> 24; // fall through
+			case G_SH: data[address] = b; data[address + 1] = b >> 8; writes = false; break;
+			default: // G_BNE
+				if (a != b) pc += g.imm - 1;
+				writes = false;
+				break;
+		}
+		if (writes && g.rd) x[g.rd] = v;
+	}
+	return count;
+}
+
+// n[k|m|g], in powers of 1024 for byte sizes and of 1000 for counts
+static bool parseSize(const char* text, uint64_t& value, bool bytes)
+{
+	char* end;
+	value = strtoull(text, &end, 0);
+	uint64_t k = bytes ? 1024 : 1000;
+	if (*end == 'k' || *end == 'K') value *= k, end++;
+	else if (*end == 'm' || *end == 'M') value *= k * k, end++;
+	else if (*end == 'g' || *end == 'G') value *= k * k * k, end++;
+	return end != text && *end == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	string out;
+	uint64_t instructions = 1000000, footprint = 64 << 10, seed = 1, body = 64;
+	double branches = 0.1, randomBranches = 0.5, mem = 0.25, stores = 0.3;
+	bool usage = false;
+	for (int a = 1; a < argc; a++){
+		string arg = argv[a];
+		bool more = a + 1 < argc;
+		if (arg == "-o" && more) out = argv[++a];
+		else if (arg == "--instructions" && more) usage |= !parseSize(argv[++a], instructions, false);
+		else if (arg == "--body" && more) usage |= !parseSize(argv[++a], body, false);
+		else if (arg == "--footprint" && more) usage |= !parseSize(argv[++a], footprint, true);
+		else if (arg == "--seed" && more) usage |= !parseSize(argv[++a], seed, false);
+		else if (arg == "--branches" && more) branches = atof(argv[++a]);
+		else if (arg == "--random-branches" && more) randomBranches = atof(argv[++a]);
+		else if (arg == "--mem" && more) mem = atof(argv[++a]);
+		else if (arg == "--stores" && more) stores = atof(argv[++a]);
+		else usage = true;
+	}
+	// the loop branch reaches 4 KB back; power-of-two footprints up to 1 GB keep the address arithmetic simple
+	if (out.empty() || usage || body == 0 || body > 1000 || footprint < 4096 || footprint > (1u << 30)
+		|| (footprint & (footprint - 1)) || branches < 0 || mem < 0 || branches + mem > 1){
+		cerr << "usage: " << argv[0] << " -o prog.txt [--instructions n] [--body n<=1000] [--branches f] [--random-branches f]\n"
+			<< "       [--mem f] [--stores f] [--footprint bytes, power of two 4k..1g] [--seed n]\n";
+		return 1;
+	}
+
+	Generator gen(seed);
+	// prologue: random values in the scratch registers, then the fixed ones
+	for (int r = 1; r <= 20; r++){
+		if (isScratch(r)) gen.li(r, gen.bits());
+	}
+	gen.li(R_BASE, DATA_BASE);
+	gen.li(R_MASK, (uint32_t)footprint - 4);
+	gen.li(R_RNG, gen.bits() | 1);
+	gen.li(R_RNG2, gen.bits() | 1);
+	size_t countAt = gen.code.size();
+	gen.li(R_COUNT, 1); // trip count, patched below
+	int32_t stride = 4 * (1 + gen.below(500));
+	size_t top = gen.code.size();
+
+	// loop body
+	gen.op(G_ADD, R_RNG, R_RNG, R_RNG2, 0); // Fibonacci mod 2^32: the high bits make decent coin flips
+	gen.op(G_SUB, R_RNG2, R_RNG, R_RNG2, 0);
+	gen.op(G_ADDI, R_INDEX, R_INDEX, 0, stride);
+	size_t slots = gen.code.size() + body;
+	while (gen.code.size() < slots){
+		double pick = gen.uniform();
+		if (pick < branches){
+			// forward branch over 1-3 ALU ops: on a counter bit (periodic) or a random bit
+			int skip = 1 + gen.below(3);
+			if (gen.uniform() < randomBranches){
+				gen.op(G_LUI, R_MASKBIT, 0, 0, 1u << (8 + gen.below(12))); // bits 20..31
+				gen.op(G_AND, R_TMP, R_RNG, R_MASKBIT, 0);
+			}
+			else{
+				gen.op(G_ANDI, R_TMP, R_COUNT, 0, 1 << gen.below(6));
+			}
+			gen.op(G_BNE, 0, R_TMP, 0, skip + 1);
+			for (int s = 0; s < skip; s++){
+				gen.alu();
+			}
+		}
+		else if (pick < branches + mem){
+			// base + ((index + offset) & mask): always inside the window, word aligned before imm
+			gen.op(G_ADDI, R_ADDR, R_INDEX, 0, 4 * (int32_t)gen.below(512) - 1024);
+			gen.op(G_AND, R_ADDR, R_ADDR, R_MASK, 0);
+			gen.op(G_ADD, R_ADDR, R_ADDR, R_BASE, 0);
+			bool store = gen.uniform() < stores, wide = gen.uniform() < 0.75;
+			if (store && wide) gen.op(G_SW, 0, R_ADDR, gen.scratch(), 0);
+			else if (store) gen.op(G_SH, 0, R_ADDR, gen.scratch(), 2 * gen.below(2));
+			else if (wide) gen.op(G_LW, gen.scratch(), R_ADDR, 0, 0);
+			else gen.op(G_LBU, gen.scratch(), R_ADDR, 0, gen.below(4));
+		}
+		else{
+			gen.alu();
+		}
+	}
+	gen.op(G_ADDI, R_COUNT, R_COUNT, 0, -1);
+	gen.op(G_BNE, 0, R_COUNT, 0, (int32_t)top - (int32_t)gen.code.size());
+	size_t loopEnd = gen.code.size();
+
+	// epilogue: a0 = sum of the scratch registers, a1 = a polynomial hash of them (order matters)
+	gen.op(G_ADDI, R_A0, 0, 0, 0);
+	gen.op(G_ADDI, R_A1, 0, 0, 0);
+	for (int r = 1; r <= 20; r++){
+		if (!isScratch(r)) continue;
+		gen.op(G_ADD, R_A0, R_A0, r, 0);
+		gen.op(G_ADD, R_A1, R_A1, R_A1, 0);
+		gen.op(G_ADD, R_A1, R_A1, r, 0);
+	}
+
+	// trip count from a one-iteration run; the count register only decides branch outcomes, so a
+	// pass costs about the same whatever it is
+	int32_t x[32];
+	GenOp& trips = gen.code[countAt];
+	uint64_t fixed = top + (gen.code.size() - loopEnd), perTrip = model(gen.code, footprint, x) - fixed;
+	uint64_t n = instructions > fixed ? (instructions - fixed + perTrip / 2) / perTrip : 1;
+	if (n < 1) n = 1;
+	if (n > 0x7FFFFFFF){
+		cerr << "too many instructions for one loop; raise --body\n";
+		return 1;
+	}
+	trips.imm = ((uint32_t)n + 0x800) >> 12;
+	gen.code[countAt + 1].imm = (int32_t)((uint32_t)n << 20) >> 20;
+	uint64_t count = model(gen.code, footprint, x);
+
+	ofstream image(out.c_str());
+	if (!image){
+		cerr << "can't write " << out << "\n";
+		return 1;
+	}
+	char hex[8];
+	for (size_t i = 0; i < gen.code.size(); i++){
+		uint32_t w = encode(gen.code[i]);
+		for (int b = 0; b < 4; b++){
+			snprintf(hex, sizeof(hex), "%02x\n", (w >> (8 * b)) & 0xFF);
+			image << hex;
+		}
+	}
+	image.close();
+	if (!image){
+		cerr << "error writing " << out << "\n";
+		return 1;
+	}
+	cout << "# " << count << " instructions, " << n << " trips, seed " << seed << "\n";
+	cout << out << " (" << x[R_A0] << "," << x[R_A1] << ")\n";
+	return 0;
+}
@@ -1,4 +1,16 @@
 #include "CPU.h"
+#include "Simulator.h"
+#include "Batch.h"
+#include "Lanes.h"
+#include "Profile.h"
+#include "Checkpoint.h"
+#include "Pipeline.h"
+#include "Trace.h"
+#include "Cache.h"
+#include "Harts.h"
+#include "CoSim.h"
+#include "BranchPredict.h"
+#include "Reuse.h"
 
 #include <iostream>
 #include <bitset>
@@ -26,156 +38,351 @@ int main(int argc, char* argv[])
 	Each line in the input file is stored as an hex and is 1 byte (each four lines are one instruction). You need to read the file line by line and store it into the memory. You may need a mechanism to convert these values to bits so that you can read opcodes, operands, etc.
 	*/
 
-	char instMem[4096];
-
-
-	if (argc < 2) {
+	// flags
+	//   -e interp    reference engine (default)
+	//   -e threaded  threaded-code engine
+	//   -e blocks    basic-block translation cache
+	//   -e jit       x86-64 JIT for hot blocks
+	//   --lockstep   (jit) check every compiled block against the interpreter
+	//   -b manifest  batch mode: run every program in the manifest in-process (see Batch.h)
+	//   -j threads   (batch) worker threads, default one per hardware thread
+	//   -o report    (batch) write the report here instead of stdout
+	//   --limit n    (batch) instructions a program may run before it is reported HUNG, default 1000000000
+	//   --sweep file run the program once per input line (a0..a7), 8 or 16 copies in lockstep
+	//   --lanes n    (sweep) copies per lockstep group, 8 (default) or 16
+	//   --profile f  run on the reference engine counting every instruction; hot-spot report to f
+	//   --profile-csv f  same, per-PC counts as CSV to f
+	//   --stack-profile f    sample the guest call stack (reference engine); folded stacks for flamegraph.pl to f
+	//   --stack-interval n   (stack-profile) instructions between samples, default 100
+	//   --symbols f          (stack-profile) "address name" lines (or nm output) naming the functions
+	//   --stop-after n   stop after exactly n instructions, on any engine
+	//   --checkpoint f   write the CPU state to f when the run stops
+	//   --restore f      start from checkpoint f instead of a program file
+	//   --pipeline f     time the run on a 5-stage pipeline (reference engine); cycles/CPI/stalls to f
+	//   --latencies a,b,c,d,e  (pipeline) IF,ID,EX,MEM,WB cycles, default 1,1,1,1,1
+	//   --no-forwarding  (pipeline) operands only come from the register file
+	//   --branch-stage s (pipeline) stage that resolves branches: ID, EX (default) or MEM
+	//   --jalr-stage s   (pipeline) same for JALR
+	//   --procsim-trace f  write the executed instructions as a CA3/procsim trace (.gz/.bz2/.xz compress, - is stdout)
+	//   --cbp-trace f    write every executed branch and jump as a CBP-2 trace for CA2's predict (same naming)
+	//   --ct path        (cbp-trace) pre-process the trace with CA2's `ct -c` at path
+	//   --trace-buffer n (traces) bytes in the ring between the simulator and the writer thread
+	//                    (k/m suffixes), default 4m; stalls waiting for the writer are reported on stderr
+	//   --cache f        run the loads/stores through an L1D/L2 model (reference engine); hit rates/stalls to f
+	//   --l1 cfg         (cache) size:ways:line[:lru|fifo|random][:wb|wt], default 32k:8:64:lru:wb
+	//   --l2 cfg|none    (cache) same for L2, default 256k:8:64:lru:wb
+	//   --l2-latency n   (cache) cycles an L1 miss that hits L2 costs, default 10
+	//   --mem-latency n  (cache) cycles a miss to memory costs, default 100
+	//   --harts n        run n harts on n threads over shared memory, a0 = hart id; prints (a0,a1) per hart
+	//   --quantum n      (harts) deterministic: harts take turns of n instructions in hart order, on the
+	//                    chosen engine (threaded and jit step any turn shorter than the program)
+	//   --cosim f        stream the executed instructions straight into CA3's procsim on a second thread;
+	//                    cycles/IPC and queue stalls to f (rdcycle/rdtime still read instret, not procsim's cycles)
+	//   --procsim R,k0,k1,k2,F  (cosim) procsim's -r -j -k -l -f, default 8,1,2,3,4
+	//   --dispatch-limit n|unlimited  (cosim) stall fetch while the dispatch queue holds n, default 4*(k0+k1+k2)
+	//                    (twice the RS); unlimited (or 0) as in procsim proper, for cycle counts that match the
+	//                    trace file exactly, but then the queue (and memory) grows with the stream
+	//   --cosim-queue n  (cosim) instructions the functional side may run ahead, default 65536
+	//   --branch-predict f  run every branch through a CA2 (CBP-2) predictor; MPKI/penalty cycles to f
+	//   --predictor p    (branch-predict) tage (CA2's my_predictor, default), bimodal or not-taken
+	//   --mispredict-penalty n  (branch-predict) front-end cycles lost per miss, default 10
+	//   --reuse f        reuse-distance histogram, miss-rate curve and working sets of the loads/stores to f
+	//   --reuse-line n   (reuse) line size in bytes, power of two, default 64
+	//   --reuse-window n (reuse) instructions per working-set window, default 100000
+	string engineName = "interp";
+	bool lockstep = false;
+	string file, manifest, reportPath, sweep, profile, profileCSV, checkpoint, restore;
+	uint64_t limit = UINT64_MAX;
+	string pipeline, procsimTrace, cbpTrace, ct, cache, cosim;
+	CoSimConfig cosimConfig;
+	string branchPredict, predictor = "tage";
+	unsigned mispredictPenalty = 10;
+	string reuse;
+	unsigned reuseLine = 64;
+	uint64_t reuseWindow = 100000;
+	string stackProfile, symbols;
+	uint64_t stackInterval = 100;
+	CacheConfig l1(32 << 10, 8, 64, 0), l2(256 << 10, 8, 64, 10);
+	bool useL2 = true;
+	unsigned memLatency = 100;
+	PipelineConfig pipeConfig;
+	unsigned threads = 0, lanes = 8;
+	uint64_t batchLimit = BATCH_DEFAULT_LIMIT;
+	unsigned harts = 1;
+	uint64_t quantum = 0;
+	size_t traceBuffer = TraceFile::DEFAULT_RING;
+	bool usage = false;
+	for (int a = 1; a < argc; a++) {
+		string arg = argv[a];
+		if (arg == "-e" && a + 1 < argc) {
+			engineName = argv[++a];
+		}
+		else if (arg == "--lockstep") {
+			lockstep = true;
+		}
+		else if (arg == "-b" && a + 1 < argc) {
+			manifest = argv[++a];
+		}
+		else if (arg == "-j" && a + 1 < argc) {
+			threads = atoi(argv[++a]);
+		}
+		else if (arg == "-o" && a + 1 < argc) {
+			reportPath = argv[++a];
+		}
+		else if (arg == "--limit" && a + 1 < argc) {
+			batchLimit = strtoull(argv[++a], NULL, 0);
+		}
+		else if (arg == "--sweep" && a + 1 < argc) {
+			sweep = argv[++a];
+		}
+		else if (arg == "--lanes" && a + 1 < argc) {
+			lanes = atoi(argv[++a]);
+		}
+		else if (arg == "--profile" && a + 1 < argc) {
+			profile = argv[++a];
+		}
+		else if (arg == "--profile-csv" && a + 1 < argc) {
+			profileCSV = argv[++a];
+		}
+		else if (arg == "--stack-profile" && a + 1 < argc) {
+			stackProfile = argv[++a];
+		}
+		else if (arg == "--stack-interval" && a + 1 < argc) {
+			stackInterval = strtoull(argv[++a], NULL, 0);
+			usage |= stackInterval == 0;
+		}
+		else if (arg == "--symbols" && a + 1 < argc) {
+			symbols = argv[++a];
+		}
+		else if (arg == "--stop-after" && a + 1 < argc) {
+			limit = strtoull(argv[++a], NULL, 0);
+		}
+		else if (arg == "--checkpoint" && a + 1 < argc) {
+			checkpoint = argv[++a];
+		}
+		else if (arg == "--restore" && a + 1 < argc) {
+			restore = argv[++a];
+		}
+		else if (arg == "--pipeline" && a + 1 < argc) {
+			pipeline = argv[++a];
+		}
+		else if (arg == "--latencies" && a + 1 < argc) {
+			usage |= !parseLatencies(argv[++a], pipeConfig);
+		}
+		else if (arg == "--no-forwarding") {
+			pipeConfig.forwarding = false;
+		}
+		else if (arg == "--branch-stage" && a + 1 < argc) {
+			usage |= !parseStage(argv[++a], pipeConfig.branchStage);
+		}
+		else if (arg == "--jalr-stage" && a + 1 < argc) {
+			usage |= !parseStage(argv[++a], pipeConfig.jalrStage);
+		}
+		else if (arg == "--procsim-trace" && a + 1 < argc) {
+			procsimTrace = argv[++a];
+		}
+		else if (arg == "--cbp-trace" && a + 1 < argc) {
+			cbpTrace = argv[++a];
+		}
+		else if (arg == "--ct" && a + 1 < argc) {
+			ct = argv[++a];
+		}
+		else if (arg == "--trace-buffer" && a + 1 < argc) {
+			char* end;
+			traceBuffer = strtoull(argv[++a], &end, 0);
+			if (*end == 'k' || *end == 'K') traceBuffer <<= 10, end++;
+			else if (*end == 'm' || *end == 'M') traceBuffer <<= 20, end++;
+			usage |= *end != 0 || traceBuffer == 0;
+		}
+		else if (arg == "--cache" && a + 1 < argc) {
+			cache = argv[++a];
+		}
+		else if (arg == "--l1" && a + 1 < argc) {
+			usage |= !parseCacheConfig(argv[++a], l1);
+		}
+		else if (arg == "--l2" && a + 1 < argc) {
+			string cfg = argv[++a];
+			useL2 = cfg != "none";
+			usage |= useL2 && !parseCacheConfig(cfg, l2);
+		}
+		else if (arg == "--l2-latency" && a + 1 < argc) {
+			l2.latency = atoi(argv[++a]);
+		}
+		else if (arg == "--mem-latency" && a + 1 < argc) {
+			memLatency = atoi(argv[++a]);
+		}
+		else if (arg == "--harts" && a + 1 < argc) {
+			harts = atoi(argv[++a]);
+			usage |= harts == 0;
+		}
+		else if (arg == "--quantum" && a + 1 < argc) {
+			quantum = strtoull(argv[++a], NULL, 0);
+		}
+		else if (arg == "--cosim" && a + 1 < argc) {
+			cosim = argv[++a];
+		}
+		else if (arg == "--procsim" && a + 1 < argc) {
+			usage |= !parseProcsimConfig(argv[++a], cosimConfig);
+		}
+		else if (arg == "--dispatch-limit" && a + 1 < argc) {
+			string limit = argv[++a];
+			cosimConfig.dispatchLimit = (limit == "unlimited") ? 0 : strtoull(limit.c_str(), NULL, 0);
+		}
+		else if (arg == "--cosim-queue" && a + 1 < argc) {
+			cosimConfig.queueEntries = strtoull(argv[++a], NULL, 0);
+		}
+		else if (arg == "--branch-predict" && a + 1 < argc) {
+			branchPredict = argv[++a];
+		}
+		else if (arg == "--predictor" && a + 1 < argc) {
+			predictor = argv[++a];
+		}
+		else if (arg == "--mispredict-penalty" && a + 1 < argc) {
+			mispredictPenalty = atoi(argv[++a]);
+		}
+		else if (arg == "--reuse" && a + 1 < argc) {
+			reuse = argv[++a];
+		}
+		else if (arg == "--reuse-line" && a + 1 < argc) {
+			reuseLine = atoi(argv[++a]);
+			usage |= reuseLine == 0 || (reuseLine & (reuseLine - 1)) != 0;
+		}
+		else if (arg == "--reuse-window" && a + 1 < argc) {
+			reuseWindow = strtoull(argv[++a], NULL, 0);
+			usage |= reuseWindow == 0;
+		}
+		else if (file.empty() && arg[0] != '-') {
+			file = arg;
+		}
+		else {
+			usage = true;
+		}
+	}
+	if (file.empty() && manifest.empty() && restore.empty()) {
 		//cout << "No file name entered. Exiting...";
 		return -1;
 	}
+	if (usage) {
+		cout << "usage: " << argv[0] << " <file> [-e interp|threaded|blocks|jit] [--lockstep]\n";
+		cout << "       " << argv[0] << " -b <manifest> [-e engine] [-j threads] [-o report] [--limit n]\n";
+		cout << "       " << argv[0] << " <file> --sweep <inputs> [--lanes 8|16]\n";
+		cout << "       " << argv[0] << " <file> [--profile report] [--profile-csv dump]\n";
+		cout << "       " << argv[0] << " <file> --stack-profile <folded> [--stack-interval n] [--symbols map]\n";
+		cout << "       " << argv[0] << " <file>|--restore <checkpoint> [-e engine] [--stop-after n] [--checkpoint out]\n";
+		cout << "       " << argv[0] << " <file> --pipeline <report> [--latencies IF,ID,EX,MEM,WB] [--no-forwarding] [--branch-stage ID|EX|MEM] [--jalr-stage ID|EX|MEM]\n";
+		cout << "       " << argv[0] << " <file> --procsim-trace <trace>[.gz|.bz2|.xz] [--stop-after n] [--trace-buffer n]\n";
+		cout << "       " << argv[0] << " <file> --cbp-trace <trace>[.gz|.bz2|.xz] [--ct path/to/ct] [--stop-after n] [--trace-buffer n]\n";
+		cout << "       " << argv[0] << " <file> --harts n [--quantum n] [-e engine]\n";
+		cout << "       " << argv[0] << " <file> --cosim <report> [--procsim R,k0,k1,k2,F] [--dispatch-limit n|unlimited] [--cosim-queue n] [--stop-after n]\n";
+		cout << "       " << argv[0] << " <file> --branch-predict <report> [--predictor tage|bimodal|not-taken] [--mispredict-penalty n]\n";
+		cout << "       " << argv[0] << " <file> --reuse <report> [--reuse-line n] [--reuse-window n]\n";
+		cout << "       " << argv[0] << " <file> --cache <report> [--l1 size:ways:line[:lru|fifo|random][:wb|wt]] [--l2 ...|none] [--l2-latency n] [--mem-latency n]\n";
+		return -1;
+	}
+	Engine engine;
+	if (!parseEngine(engineName, engine)) {
+		cout << "unknown engine " << engineName << "\n";
+		return -1;
+	}
 
-	ifstream infile(argv[1]); //open the file
-	if (!(infile.is_open() && infile.good())) {
-		cout<<"error opening file\n";
-		return 0; 
+	if (!manifest.empty()) {
+		int failed = runBatch(manifest, engine, threads, batchLimit, reportPath);
+		return failed == 0 ? 0 : 1;
 	}
-	string line; 
-	int i = 0;
-	while (infile) {
-			infile>>line;
-			stringstream line2(line);
-			char x; 
-			line2>>x;
-			instMem[i] = x; // be careful about hex
-			i++;
-			line2>>x;
-			instMem[i] = x; // be careful about hex
-			//cout<<instMem[i]<<endl;
-			i++;
-		}
-	int maxPC= i/8; 
 
 	/* Instantiate your CPU object here.  CPU class is the main class in this project that defines different components of the processor.
 	CPU class also has different functions for each stage (e.g., fetching an instruction, decoding, etc.).
+	The Simulator owns it (the same machine libcpusim embeds) and decodes the whole program once on load;
+	the engines only ever look at myCPU.program.
 	*/
+	Simulator sim;
+	CPU& myCPU = sim.cpu();
 
-	CPU myCPU;  // call the approriate constructor here to initialize the processor...  
-	// make sure to create a variable for PC and resets it to zero (e.g., unsigned int PC = 0); 
-
-	/* OPTIONAL: Instantiate your Instruction object here. */
-	Instruction myInst; 
-
-	bool done = true;
-	while (done == true) // processor's main loop. Each iteration is equal to one clock cycle.  
-	{
-		//fetch instruction from instMem and PC
-		myInst = myCPU.fetchInstruction(instMem);
-		// cout << myInst.instr << endl;
-		if (myInst.getOpCode().to_string() == "0000000"){
-			break;
+	// instruction memory grows with the program: text (one hex byte per line) or raw .bin words
+	if (!restore.empty()) {
+		if (!loadCheckpoint(myCPU, restore)) {
+			return 1;
 		}
+	}
+	else if (!sim.load(file)) {
+		cout<<"error opening file\n";
+		return 0; 
+	}
 
-		// decode
-		// cout << myInst.getOpCode() << endl;
-		myCPU.cpu_control.setController(myInst.getOpCode()); // set the controller using opcode
-
-		// update rs1, rs2, rd, imm values as necessary and according to control rules
-		myCPU.updateValuesInstructionDecode(myInst);
-
-		// execute ALU_Control and ALU
-		myCPU.alu_control.setALUControl(myCPU.cpu_control.aluop, myInst); // get the 4-bit code to ALU
-		
-		int secondvalue;
-		// logic of mux to choose rs2 or imm
-		if (myCPU.cpu_control.alusrc == 1){
-			secondvalue = myCPU.imm;
-			//cout << "second (imm): " << secondvalue << endl;
-		}
-		else{
-			secondvalue = myCPU.regfile[myCPU.rs2];
-			//cout << "second (rs2): " << secondvalue << endl;
-		}
-		int firstvalue = myCPU.regfile[myCPU.rs1];
-		//cout << "first: " << firstvalue << endl;
-		myCPU.alu.executeALU(myCPU.alu_control.fourbitout, firstvalue, secondvalue, myCPU.cpu_control.islui);
-
-		// mem
-		// do branching section here
-		if (myCPU.cpu_control.branch == 1){
-			// if BNE
-			if (myCPU.cpu_control.regwrite != 1){
-				if (myCPU.alu.zero == 1){
-					// they are equal, so dont branch BNE
-					myCPU.incPC();
-				}
-				else{ // gotta branch to label which is immediate
-					int decrement = myCPU.imm << 1;
-					//cout << "decrement: " << decrement << endl;
-					myCPU.setPC(myCPU.readPC() + decrement/4);
-				}
-			}
-			else{ //JALR
-				// write address to jump back to to reg rd
-				if (myCPU.rd != 0){ // only if not x0
-					myCPU.regfile[myCPU.rd] = 4*myCPU.readPC() + 4;	
-				}
-				//cout << "JALR PC + 1: " << myCPU.readPC() + 1 << endl;
-				// jump to reg[rs1] + offset [31:1], 1'b0
-				uint32_t address = myCPU.alu.alu_res & ~1;
-				myCPU.setPC(address/4);
-			}
-			//cout << endl;
-			continue; // skip rest of loop
-		}
-		
+	if (!sweep.empty()) {
+		if (!runSweep(myCPU, sweep, lanes, cout)) {
+			cout << "can't run sweep " << sweep << " on " << lanes << " lanes\n";
+			return -1;
+		}
+		return 0;
+	}
 
-		
-		// if mem write is true (STORE WORD)
-		if (myCPU.cpu_control.memwr == 1){
-			// check func3: if 010 then SW
-			if (myInst.getfunc3().to_string() == "010"){
-				myCPU.storeword(myCPU.alu.alu_res, myCPU.regfile[myCPU.rs2]);
-			}
-			else{ // SH
-				myCPU.storehalf(myCPU.alu.alu_res, myCPU.regfile[myCPU.rs2]);
-			}
-			//cout << "Stored: " << myCPU.regfile[myCPU.rs2] << " in address " << myCPU.alu.alu_res << endl;
-		}
-		
-		int resToWriteBack;
-		// if mem to reg is 0 take alu result
-		if (myCPU.cpu_control.memtoreg == 0){
-			resToWriteBack = myCPU.alu.alu_res;
-		}
-		else{ // take data that was read
-			if (myCPU.cpu_control.memre == 1){ // (LOAD WORD)
-				// check func3: if 010 then LW
-				if (myInst.getfunc3().to_string() == "010"){
-					resToWriteBack = myCPU.loadword(myCPU.alu.alu_res);
-				}
-				else{
-					resToWriteBack = myCPU.loadbyteunsigned(myCPU.alu.alu_res);
-				}
-				//cout << "Loaded: " << resToWriteBack << " into register " << myCPU.rd << endl;
-			}
+	if (harts > 1) {
+		Harts machine(myCPU, harts);
+		if (!machine.run(engine, lockstep, quantum)) {
+			return 1;
+		}
+		for (unsigned id = 0; id < machine.size(); id++) {
+			cout << "(" << machine.hart(id).regfile[10] << "," << machine.hart(id).regfile[11] << ")" << endl;
 		}
+		return 0;
+	}
 
-		// write back (can't write to x0)
-		if (myCPU.cpu_control.regwrite == 1 && myCPU.rd != 0){
-			myCPU.regfile[myCPU.rd] = resToWriteBack;
-			//cout << "RES: " << resToWriteBack << endl;
+	if (!profile.empty() || !profileCSV.empty()) {
+		if (!runProfiled(myCPU, profile, profileCSV)) {
+			return 1;
+		}
+	}
+	else if (!stackProfile.empty()) {
+		if (!runStackProfile(myCPU, stackProfile, stackInterval, symbols)) {
+			return 1;
+		}
+	}
+	else if (!pipeline.empty()) {
+		if (!runPipeline(myCPU, pipeConfig, pipeline)) {
+			return 1;
+		}
+	}
+	else if (!procsimTrace.empty()) {
+		if (!runProcsimTrace(myCPU, procsimTrace, limit, traceBuffer)) {
+			return 1;
+		}
+	}
+	else if (!cache.empty()) {
+		if (!runCache(myCPU, l1, useL2 ? &l2 : NULL, memLatency, cache)) {
+			return 1;
 		}
-		//cout << endl;
-		myCPU.incPC();
-		if (myCPU.readPC() > maxPC)
-			break;
+	}
+	else if (!cosim.empty()) {
+		if (!runCoSim(myCPU, cosimConfig, limit, cosim)) {
+			return 1;
+		}
+	}
+	else if (!branchPredict.empty()) {
+		if (!runBranchPredict(myCPU, predictor, mispredictPenalty, branchPredict)) {
+			return 1;
+		}
+	}
+	else if (!reuse.empty()) {
+		if (!runReuse(myCPU, reuseLine, reuseWindow, reuse)) {
+			return 1;
+		}
+	}
+	else if (!cbpTrace.empty()) {
+		if (!runCBPTrace(myCPU, cbpTrace, ct, limit, traceBuffer)) {
+			return 1;
+		}
+	}
+	else if (!myCPU.run(engine, lockstep, limit)) {
+		return 1;
+	}
+	if (!checkpoint.empty() && !saveCheckpoint(myCPU, checkpoint)) {
+		return 1;
 	}
 	int a0 =myCPU.regfile[10];
 	int a1 =myCPU.regfile[11];  
 	// print the results (you should replace a0 and a1 with your own variables that point to a0 and a1)
 	cout << "(" << a0 << "," << a1 << ")" << endl;
-	//cout << instMem[0] << ", " << instMem[1] << endl;
-	//cout << i << " " << maxPC << endl;
 	return 0;
 
 }
\ No newline at end of file
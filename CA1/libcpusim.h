@@ -0,0 +1,47 @@
+#ifndef LIBCPUSIM_H
+#define LIBCPUSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+C interface to the simulator (see Simulator.h for the C++ one). Link with libcpusim.a and the C++
+runtime. A cpusim is one machine: load an image once, then reset and run it as often as needed;
+reset reuses everything already allocated. Separate instances can run on separate threads.
+Functions returning int give 0 on success and -1 on failure.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CPUSIM_UNLIMITED UINT64_MAX
+
+typedef struct cpusim cpusim;
+
+cpusim* cpusim_new(void);
+void cpusim_free(cpusim* sim);
+
+int cpusim_load_file(cpusim* sim, const char* path); /* hex text image or .bin words */
+void cpusim_load_words(cpusim* sim, const uint32_t* words, size_t count);
+int cpusim_set_engine(cpusim* sim, const char* name); /* "interp", "threaded", "blocks" or "jit" */
+void cpusim_reset(cpusim* sim);
+
+/* run up to max instructions (CPUSIM_UNLIMITED: until halt); returns how many ran */
+uint64_t cpusim_run(cpusim* sim, uint64_t max);
+int cpusim_halted(cpusim* sim); /* 1 if the next instruction is a halt */
+
+int32_t cpusim_get_reg(cpusim* sim, unsigned reg);
+void cpusim_set_reg(cpusim* sim, unsigned reg, int32_t value); /* writes to x0 are ignored */
+uint32_t cpusim_get_pc(cpusim* sim); /* byte address */
+void cpusim_set_pc(cpusim* sim, uint32_t address);
+void cpusim_read_mem(cpusim* sim, uint32_t address, void* data, size_t len);
+void cpusim_write_mem(cpusim* sim, uint32_t address, const void* data, size_t len);
+
+uint64_t cpusim_instret(cpusim* sim); /* instructions retired since the last reset */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBCPUSIM_H */
@@ -82,8 +82,19 @@ void print_timing_output();
 // Termination check
 static bool all_instructions_done();
 
-// big table for output
-static vector<proc_inst_t> g_inst_table;  // 1-based index by tag
+// big table for output, indexed by tag - g_table_base (tag 0 is unused)
+static deque<proc_inst_t> g_inst_table;
+static uint64_t g_table_base = 0;
+
+// streaming (set_proc_streaming): keep only the instructions still in flight in g_inst_table,
+// and stop fetching while the dispatch queue holds g_dispatch_limit instructions (0 = no limit)
+static bool g_streaming = false;
+static uint64_t g_dispatch_limit = 0;
+
+static proc_inst_t& table_entry(uint64_t tag)
+{
+    return g_inst_table[tag - g_table_base];
+}
 
 /**
  * Subroutine for initializing the processor. You many add and initialize any global or heap
@@ -137,7 +148,25 @@ void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f)
 
     g_inst_table.clear();
     g_inst_table.resize(1); // index 0 unused, tags start at 1
+    g_table_base = 0;
+    g_streaming = false;
+    g_dispatch_limit = 0;
+
+}
 
+/**
+ * Switches the processor set up by setup_proc to streaming: an instruction is forgotten once it
+ * has retired (so print_timing_output has nothing to print), and with dispatch_limit > 0 fetch
+ * stalls while the dispatch queue holds that many instructions. With both, memory stays bounded
+ * however long the stream is; the limit changes the timing, since the dispatch queue is otherwise
+ * unlimited.
+ */
+void set_proc_streaming(uint64_t dispatch_limit)
+{
+    g_streaming = true;
+    g_dispatch_limit = dispatch_limit;
+    g_inst_table.clear(); // drop the unused tag 0 so the table starts at the first instruction
+    g_table_base = 1;
 }
 
 /**
@@ -234,7 +263,18 @@ static void stage_fetch(){
     // clear the pipeline register between fetch and dispatch
 
     // Try to fetch up to g_F instructions per cycle
-    for (uint64_t i = 0; i < g_F; i++) {
+    uint64_t width = g_F;
+    if (g_streaming) {
+        // retired instructions are never looked at again
+        while (!g_inst_table.empty() && g_inst_table.front().state_cycle != 0) {
+            g_inst_table.pop_front();
+            g_table_base++;
+        }
+        if (g_dispatch_limit) {
+            width = (g_dispatch_q.size() >= g_dispatch_limit) ? 0 : min(width, g_dispatch_limit - g_dispatch_q.size());
+        }
+    }
+    for (uint64_t i = 0; i < width; i++) {
         proc_inst_t inst{};
         if (!read_instruction(&inst)) {
             g_no_more_fetch = true;
@@ -249,11 +289,11 @@ static void stage_fetch(){
         inst.state_cycle = 0;
 
         // add another index to the table for output
-        if (g_inst_table.size() <= inst.tag) {
-            g_inst_table.resize(inst.tag + 1);
+        if (g_inst_table.size() + g_table_base <= inst.tag) {
+            g_inst_table.resize(inst.tag + 1 - g_table_base);
         }
         // set the instruction and update the fetch cycle.
-        g_inst_table[inst.tag] = inst;
+        table_entry(inst.tag) = inst;
 
         // Put into fetch/dispatch pipeline
         g_fetched.push_back(inst);
@@ -266,7 +306,7 @@ static void stage_dispatch()
     // Loop through all fetched instructions
     for (auto& inst : g_fetched) {
         g_dispatch_q.push_back(inst);
-        g_inst_table[inst.tag].disp_cycle = g_cycle_count; // set the dispatch cycle
+        table_entry(inst.tag).disp_cycle = g_cycle_count; // set the dispatch cycle
     }
 }
 
@@ -297,7 +337,7 @@ static void stage_schedule(int rs_free_start)
         g_dispatch_q.pop_front();
         used_this_cycle++;
         // Set schedule cycle
-        g_inst_table[inst.tag].sched_cycle = g_cycle_count;
+        table_entry(inst.tag).sched_cycle = g_cycle_count;
 
         // Create RS entry
         RsEntry &entry = g_rs[free_rs_idx];
@@ -392,7 +432,7 @@ static void stage_execute_fire()
             
             entry.issued = true;
             entry.fu_index = free_fu;
-            g_inst_table[entry.inst.tag].exec_cycle = g_cycle_count;
+            table_entry(entry.inst.tag).exec_cycle = g_cycle_count;
             
             g_total_inst_fired++;
         }
@@ -424,8 +464,8 @@ static void stage_execute_writeback()
     // Sort by exec_cycle first, then by tag
     sort(completed_tags.begin(), completed_tags.end(), 
          [](uint64_t tag_a, uint64_t tag_b) {
-             uint64_t exec_a = g_inst_table[tag_a].exec_cycle;
-             uint64_t exec_b = g_inst_table[tag_b].exec_cycle;
+             uint64_t exec_a = table_entry(tag_a).exec_cycle;
+             uint64_t exec_b = table_entry(tag_b).exec_cycle;
              
              if (exec_a != exec_b) {
                  return exec_a < exec_b;  // Lower exec_cycle first
@@ -443,7 +483,7 @@ static void stage_execute_writeback()
         for (auto &entry : g_rs) {
             if (entry.inst.tag == tag) {
                 entry.completed = true;
-                g_inst_table[entry.inst.tag].state_cycle = g_cycle_count;
+                table_entry(entry.inst.tag).state_cycle = g_cycle_count;
                 break;
             }
         }
@@ -497,8 +537,8 @@ static void stage_state_update()
 
         if (g_rs[idx].inst.dest_reg != -1) {
             // if Latest Tag Dependent matches Retiring Tag
-            int latest_tag = *g_reg_producer_tag[g_rs[idx].inst.dest_reg].rbegin(); //get the last tag (largest)
-            int retiring_tag = g_rs[idx].inst.tag;
+            uint64_t latest_tag = *g_reg_producer_tag[g_rs[idx].inst.dest_reg].rbegin(); //get the last tag (largest)
+            uint64_t retiring_tag = g_rs[idx].inst.tag;
             auto &S = g_reg_producer_tag[g_rs[idx].inst.dest_reg];
             // if Latest Tag Dependent matches Retiring Tag
             if (latest_tag == retiring_tag)
@@ -506,7 +546,7 @@ static void stage_state_update()
             
             // iterate through and set as ready in RS
             for (auto &entry : g_rs) {
-                int consumer_tag = entry.inst.tag; 
+                uint64_t consumer_tag = entry.inst.tag; 
                 // find cases where the src matches the destination register
                 if (entry.inst.src_reg[0] == g_rs[idx].inst.dest_reg) {
                     // only if the tag of this instruction is greater than the retiring instruction
@@ -529,7 +569,7 @@ static void stage_state_update()
 
                     if (it != S.begin()) {
                         auto prev_it = std::prev(it);        // last producer < consumer_tag
-                        int prev_tag = *prev_it;
+                        uint64_t prev_tag = *prev_it;
 
                         if (prev_tag == retiring_tag) {
                             // retiring_tag is the last producer before this consumer
@@ -559,7 +599,7 @@ static void stage_state_update()
 
                     if (it != S.begin()) {
                         auto prev_it = std::prev(it);        // last producer < consumer_tag
-                        int prev_tag = *prev_it;
+                        uint64_t prev_tag = *prev_it;
 
                         if (prev_tag == retiring_tag) {
                             // retiring_tag is the last producer before this consumer
@@ -625,9 +665,9 @@ void print_timing_output()
     // Header – MUST be tabs, not spaces
     printf("INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n");
 
-    // tags go from 1 to g_inst_table.size()-1
-    for (size_t tag = 1; tag < g_inst_table.size(); ++tag) {
-        const auto &inst = g_inst_table[tag];
+    // tags go from 1 to the last one fetched (streaming: only those not yet retired)
+    for (size_t tag = max<uint64_t>(g_table_base, 1); tag < g_table_base + g_inst_table.size(); ++tag) {
+        const auto &inst = table_entry(tag);
 
         printf("%zu\t%lu\t%lu\t%lu\t%lu\t%lu\n",
                tag,
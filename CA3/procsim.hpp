@@ -45,4 +45,7 @@ void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f);
 void run_proc(proc_stats_t* p_stats);
 void complete_proc(proc_stats_t* p_stats);
 
+// call after setup_proc to run an endless instruction stream in bounded memory (see procsim.cpp)
+void set_proc_streaming(uint64_t dispatch_limit);
+
 #endif /* PROCSIM_HPP */